@@ -0,0 +1,239 @@
+/**
+ * async.c - Asynchronous transmit queue
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+
+#include "sx1231_ods.h"
+#include "sx1231_ods_time.h"
+
+/**
+ * Queued transmit request
+ */
+typedef struct {
+	const uint8_t *data;	/**< Frame data */
+	size_t len;		/**< Frame length */
+	rf_tx_cb_t cb;		/**< Completion callback, may be NULL */
+	void *ctx;		/**< Callback context */
+	uint64_t submitted;	/**< Time rf_submit() was called */
+	atomic_bool ready;	/**< Request is written and can be sent */
+} tx_req_t;
+
+/**
+ * Asynchronous transmit state
+ *
+ * The request queue is a multi-producer/single-consumer ring. Submitting
+ * threads claim a slot by advancing head, and mark it ready once written.
+ * Only the TX thread writes tail. The semaphore counts queued requests, so
+ * the TX thread can sleep while the queue is empty.
+ */
+struct rf_async {
+	rf_dev_t *dev;		/**< Device handle */
+	pthread_t thread;	/**< TX thread */
+	sem_t pending;		/**< Amount of queued requests */
+	atomic_bool stop;	/**< Exit TX thread once queue is empty */
+	atomic_size_t head;	/**< Next slot to submit to */
+	atomic_size_t tail;	/**< Next slot to send */
+	tx_req_t reqs[RF_ASYNC_QUEUE_LEN]; /**< Request ring */
+};
+
+static void *_tx_thread(void *arg);
+
+int rf_async_start(rf_dev_t *dev)
+{
+	struct rf_async *async;
+	int ret;
+
+	if (atomic_load_explicit(&dev->async, memory_order_acquire) != NULL) {
+		return ERR_INVAL;
+	}
+
+	async = malloc(sizeof(*async));
+	if (async == NULL) {
+		return ERR_UNSPEC;
+	}
+
+	async->dev = dev;
+	atomic_init(&async->stop, false);
+	atomic_init(&async->head, 0);
+	atomic_init(&async->tail, 0);
+	for (size_t i = 0; i < RF_ASYNC_QUEUE_LEN; i++) {
+		atomic_init(&async->reqs[i].ready, false);
+	}
+	if (sem_init(&async->pending, 0, 0) != 0) {
+		free(async);
+		return ERR_THREAD;
+	}
+
+	ret = pthread_create(&async->thread, NULL, _tx_thread, async);
+	if (ret != 0) {
+		sem_destroy(&async->pending);
+		free(async);
+		errno = ret;
+		return ERR_THREAD;
+	}
+
+	// Publish initialized state to rf_submit()
+	atomic_store_explicit(&dev->async, async, memory_order_release);
+
+	return ERR_OK;
+}
+
+int rf_async_stop(rf_dev_t *dev)
+{
+	struct rf_async *async;
+
+	// Refuse new frames, including from callbacks while draining. The
+	// caller guarantees no other thread is inside rf_submit() anymore.
+	async = atomic_exchange_explicit(&dev->async, NULL,
+				memory_order_acq_rel);
+	if (async == NULL) {
+		return ERR_INVAL;
+	}
+
+	atomic_store(&async->stop, true);
+	sem_post(&async->pending);
+	pthread_join(async->thread, NULL);
+
+	sem_destroy(&async->pending);
+	free(async);
+
+	return ERR_OK;
+}
+
+int rf_submit(rf_dev_t *dev, const uint8_t *data, size_t len, rf_tx_cb_t cb,
+		void *ctx)
+{
+	struct rf_async *async;
+	tx_req_t *req;
+	size_t head;
+
+	async = atomic_load_explicit(&dev->async, memory_order_acquire);
+	if (async == NULL) {
+		return ERR_INVAL;
+	}
+
+	// Claim slot, other threads may submit at the same time
+	head = atomic_load_explicit(&async->head, memory_order_relaxed);
+	do {
+		if (head - atomic_load_explicit(&async->tail,
+					memory_order_acquire) >=
+				RF_ASYNC_QUEUE_LEN) {
+			return ERR_BUSY;
+		}
+	} while (!atomic_compare_exchange_weak_explicit(&async->head, &head,
+				head + 1, memory_order_relaxed,
+				memory_order_relaxed));
+
+	req = &async->reqs[head % RF_ASYNC_QUEUE_LEN];
+	req->data = data;
+	req->len = len;
+	req->cb = cb;
+	req->ctx = ctx;
+	req->submitted = time_now_ns();
+
+	// Publish request before waking the TX thread
+	atomic_store_explicit(&req->ready, true, memory_order_release);
+	sem_post(&async->pending);
+
+	return ERR_OK;
+}
+
+/**
+ * Send queued requests till stopped
+ */
+static void *_tx_thread(void *arg)
+{
+	struct rf_async *async = arg;
+	rf_dev_t *dev = async->dev;
+	rf_tx_result_t res;
+	tx_req_t *slot;
+	tx_req_t req;
+	size_t tail;
+
+	while (true) {
+		// Let transmission finish, and module go idle, when queue is
+		// empty
+		if (sem_trywait(&async->pending) != 0) {
+			rf_flush(dev);
+			while (sem_wait(&async->pending) != 0) {
+				// Interrupted by signal
+			}
+		}
+
+		tail = atomic_load_explicit(&async->tail, memory_order_relaxed);
+		if (tail == atomic_load_explicit(&async->head,
+					memory_order_acquire)) {
+			// Woken by rf_async_stop() with an empty queue
+			if (atomic_load(&async->stop)) {
+				break;
+			}
+			continue;
+		}
+
+		// A later slot may be published first, the producer of this
+		// one is still writing it. It claimed the slot right before, so
+		// this only spins for the few stores left in rf_submit(),
+		// unless that thread was preempted in between.
+		slot = &async->reqs[tail % RF_ASYNC_QUEUE_LEN];
+		while (!atomic_load_explicit(&slot->ready,
+					memory_order_acquire)) {
+			sched_yield();
+		}
+		req.data = slot->data;
+		req.len = slot->len;
+		req.cb = slot->cb;
+		req.ctx = slot->ctx;
+		req.submitted = slot->submitted;
+		atomic_store_explicit(&slot->ready, false,
+				memory_order_relaxed);
+		atomic_store_explicit(&async->tail, tail + 1,
+				memory_order_release);
+
+		res.submitted = req.submitted;
+		res.dequeued = time_now_ns();
+		res.err = rf_send(dev, req.data, req.len);
+		res.tx_start = dev->last_tx_start;
+		res.tx_end = dev->tx_pending ? dev->tx_end : time_now_ns();
+
+		if (req.cb != NULL) {
+			req.cb(req.ctx, &res);
+		}
+	}
+
+	rf_flush(dev);
+	return NULL;
+}
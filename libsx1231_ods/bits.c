@@ -0,0 +1,150 @@
+/**
+ * bits.c - Bit-packed frame builder
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "bits.h"
+#include "sx1231_ods_error.h"
+
+#define ACC_MAX_APPEND	56	// Bits that always fit next to a partial byte
+
+void bits_init(bits_builder_t *bb, uint8_t *buf, size_t size)
+{
+	bb->buf = buf;
+	bb->size = size;
+	bb->len = 0;
+	bb->acc = 0;
+}
+
+/**
+ * Append up to ACC_MAX_APPEND bits
+ *
+ * Shifts the bits into the accumulator, holding the partial last byte, and
+ * stores all completed bytes.
+ */
+static void _append(bits_builder_t *bb, uint64_t val, unsigned int cnt)
+{
+	unsigned int acc_bits = bb->len % 8;
+	uint8_t *out = &bb->buf[bb->len / 8];
+	uint64_t acc;
+
+	acc = (bb->acc << cnt) | (val & ((1ULL << cnt) - 1));
+	acc_bits += cnt;
+	bb->len += cnt;
+
+	while (acc_bits >= 8) {
+		acc_bits -= 8;
+		*out++ = acc >> acc_bits;
+	}
+
+	acc &= (1ULL << acc_bits) - 1;
+	if (acc_bits != 0) {
+		*out = acc << (8 - acc_bits);
+	}
+	bb->acc = acc;
+}
+
+int bits_append(bits_builder_t *bb, uint64_t val, unsigned int cnt)
+{
+	if (cnt > 64 || bb->len + cnt > bb->size * 8) {
+		return ERR_RANGE;
+	}
+
+	if (cnt > ACC_MAX_APPEND) {
+		_append(bb, val >> ACC_MAX_APPEND, cnt - ACC_MAX_APPEND);
+		cnt = ACC_MAX_APPEND;
+	}
+	if (cnt != 0) {
+		_append(bb, val, cnt);
+	}
+
+	return ERR_OK;
+}
+
+int bits_append_run(bits_builder_t *bb, int bit, size_t cnt)
+{
+	uint64_t val = bit ? UINT64_MAX : 0;
+	unsigned int n;
+
+	if (bb->len + cnt > bb->size * 8) {
+		return ERR_RANGE;
+	}
+
+	// Complete partial byte, then fill whole bytes at once
+	n = (8 - bb->len % 8) % 8;
+	if (n > cnt) {
+		n = cnt;
+	}
+	_append(bb, val, n);
+	cnt -= n;
+
+	if (bb->len % 8 == 0 && cnt >= 8) {
+		memset(&bb->buf[bb->len / 8], (uint8_t) val, cnt / 8);
+		bb->len += cnt / 8 * 8;
+		cnt %= 8;
+	}
+
+	if (cnt != 0) {
+		_append(bb, val, cnt);
+	}
+
+	return ERR_OK;
+}
+
+int bits_append_bytes(bits_builder_t *bb, const uint8_t *data, size_t len)
+{
+	uint64_t val;
+	size_t n;
+
+	if (bb->len + len * 8 > bb->size * 8) {
+		return ERR_RANGE;
+	}
+
+	if (bb->len % 8 == 0) {
+		memcpy(&bb->buf[bb->len / 8], data, len);
+		bb->len += len * 8;
+		return ERR_OK;
+	}
+
+	// Unaligned, append 7 bytes per shift
+	while (len != 0) {
+		n = (len < ACC_MAX_APPEND / 8) ? len : ACC_MAX_APPEND / 8;
+		val = 0;
+		for (size_t i = 0; i < n; i++) {
+			val = (val << 8) | data[i];
+		}
+		_append(bb, val, n * 8);
+		data += n;
+		len -= n;
+	}
+
+	return ERR_OK;
+}
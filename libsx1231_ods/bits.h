@@ -0,0 +1,105 @@
+/**
+ * bits.h - Bit-packed frame builder
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __BITS_H__
+#define __BITS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Bit-packed frame builder
+ *
+ * Packs bits MSB first into a caller supplied buffer, so frames don't have to
+ * be padded to a byte boundary per symbol. The buffer always holds the bits
+ * appended so far, with the unused bits of the last byte set to 0.
+ */
+typedef struct {
+	uint8_t *buf;		/**< Output buffer */
+	size_t size;		/**< Size of output buffer, in bytes */
+	size_t len;		/**< Amount of bits in buffer */
+	uint64_t acc;		/**< Bits of last, partial, byte */
+} bits_builder_t;
+
+/**
+ * Initialize frame builder
+ *
+ * @param bb	Frame builder
+ * @param buf	Buffer to write frame to
+ * @param size	Size of buffer, in bytes
+ */
+void bits_init(bits_builder_t *bb, uint8_t *buf, size_t size);
+
+/**
+ * Append bits to frame
+ *
+ * @param bb	Frame builder
+ * @param val	Bits to append, in the lowest 'cnt' bits, MSB is sent first
+ * @param cnt	Amount of bits to append, at most 64
+ *
+ * @returns	0 on success, ERR_RANGE if the buffer is full
+ */
+int bits_append(bits_builder_t *bb, uint64_t val, unsigned int cnt);
+
+/**
+ * Append a run of identical bits to frame
+ *
+ * @param bb	Frame builder
+ * @param bit	Value of bits, 0 or 1
+ * @param cnt	Amount of bits to append
+ *
+ * @returns	0 on success, ERR_RANGE if the buffer is full
+ */
+int bits_append_run(bits_builder_t *bb, int bit, size_t cnt);
+
+/**
+ * Append bytes to frame
+ *
+ * The bytes don't need to be aligned to a byte boundary in the frame.
+ *
+ * @param bb	Frame builder
+ * @param data	Bytes to append
+ * @param len	Amount of bytes
+ *
+ * @returns	0 on success, ERR_RANGE if the buffer is full
+ */
+int bits_append_bytes(bits_builder_t *bb, const uint8_t *data, size_t len);
+
+/**
+ * Get length of frame
+ *
+ * @param bb	Frame builder
+ *
+ * @returns	Amount of bits in frame
+ */
+static inline size_t bits_len(const bits_builder_t *bb)
+{
+	return bb->len;
+}
+
+#endif // __BITS_H__
@@ -0,0 +1,151 @@
+/**
+ * gpio.c - GPIO line helper functions
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "gpio.h"
+#include "sx1231_ods_error.h"
+#include "sx1231_ods_debug.h"
+
+#define GPIO_CONSUMER "sx1231_ods"
+
+static int _gpiocdev_get(gpio_line_t *line, int *value);
+static int _gpiocdev_wait(gpio_line_t *line, int timeout_ms);
+static void _gpiocdev_close(gpio_line_t *line);
+
+static const gpio_ops_t _gpiocdev_ops = {
+	.get = _gpiocdev_get,
+	.wait = _gpiocdev_wait,
+	.close = _gpiocdev_close,
+};
+
+int gpio_open_input(gpio_line_t *line, const char *chip_path, unsigned int offset)
+{
+	struct gpio_v2_line_request req;
+	int chip_fd;
+	int err;
+
+	chip_fd = open(chip_path, O_RDONLY | O_CLOEXEC);
+	if (chip_fd == -1) {
+		return ERR_GPIO_OPEN_DEV;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.offsets[0] = offset;
+	req.num_lines = 1;
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT |
+			GPIO_V2_LINE_FLAG_EDGE_RISING |
+			GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	strncpy(req.consumer, GPIO_CONSUMER, sizeof(req.consumer) - 1);
+
+	err = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req);
+	SAVE_ERRNO(close(chip_fd));
+	if (err < 0) {
+		perror("GPIO_V2_GET_LINE_IOCTL");
+		return ERR_GPIO_IOCTL;
+	}
+
+	// Events are drained after every wait
+	if (fcntl(req.fd, F_SETFL, O_NONBLOCK) < 0) {
+		SAVE_ERRNO(close(req.fd));
+		return ERR_GPIO_IOCTL;
+	}
+
+	line->fd = req.fd;
+	line->priv = NULL;
+	line->ops = &_gpiocdev_ops;
+
+	DBG_PRINTF(DBG_LVL_LOW, "GPIO %s:%u opened\n", chip_path, offset);
+
+	return ERR_OK;
+}
+
+void gpio_close(gpio_line_t *line)
+{
+	if (line->ops != NULL) {
+		line->ops->close(line);
+		line->ops = NULL;
+	}
+}
+
+static int _gpiocdev_get(gpio_line_t *line, int *value)
+{
+	struct gpio_v2_line_values vals;
+
+	memset(&vals, 0, sizeof(vals));
+	vals.mask = 1;
+
+	if (ioctl(line->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &vals) < 0) {
+		perror("GPIO_V2_LINE_GET_VALUES_IOCTL");
+		return ERR_GPIO_IOCTL;
+	}
+
+	*value = vals.bits & 1;
+
+	return ERR_OK;
+}
+
+static int _gpiocdev_wait(gpio_line_t *line, int timeout_ms)
+{
+	struct gpio_v2_line_event event;
+	struct pollfd pfd;
+	int ret;
+
+	pfd.fd = line->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	ret = poll(&pfd, 1, timeout_ms);
+	if (ret < 0 && errno != EINTR) {
+		perror("poll");
+		return ERR_GPIO_IOCTL;
+	}
+
+	// Drain events, only the current line value is of interest
+	while (read(line->fd, &event, sizeof(event)) == sizeof(event));
+
+	return ERR_OK;
+}
+
+static void _gpiocdev_close(gpio_line_t *line)
+{
+	close(line->fd);
+	line->fd = -1;
+}
@@ -0,0 +1,127 @@
+/**
+ * gpio.h - GPIO line helper functions
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __GPIO_H__
+#define __GPIO_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct gpio_line gpio_line_t;
+
+/**
+ * GPIO line operations
+ */
+typedef struct {
+	/**
+	 * Get current line value
+	 *
+	 * @param line		GPIO line handle
+	 * @param value		Pointer to location to store value, 0 or 1
+	 *
+	 * @returns	0 on success
+	 */
+	int (*get)(gpio_line_t *line, int *value);
+
+	/**
+	 * Wait for the line value to change
+	 *
+	 * May return early without the value having changed, the caller
+	 * should check the value again.
+	 *
+	 * @param line		GPIO line handle
+	 * @param timeout_ms	Maximum time to wait, -1 to wait indefinitely
+	 *
+	 * @returns	0 on success, also if timed out
+	 */
+	int (*wait)(gpio_line_t *line, int timeout_ms);
+
+	/**
+	 * Release line
+	 *
+	 * @param line		GPIO line handle
+	 */
+	void (*close)(gpio_line_t *line);
+} gpio_ops_t;
+
+/**
+ * GPIO line handle
+ */
+struct gpio_line {
+	const gpio_ops_t *ops;	/**< Line operations, NULL if not opened */
+	int fd;			/**< Line request file descriptor, or -1 */
+	void *priv;		/**< Backend private data */
+};
+
+/**
+ * Open GPIO line as input with edge events
+ *
+ * Uses the Linux GPIO character device interface.
+ *
+ * @param line		GPIO line handle to initialize
+ * @param chip_path	Path to GPIO chip device, eg. /dev/gpiochip0
+ * @param offset	Line offset within the GPIO chip
+ *
+ * @returns	0 on success
+ */
+int gpio_open_input(gpio_line_t *line, const char *chip_path, unsigned int offset);
+
+/**
+ * Get current line value
+ *
+ * @param line		GPIO line handle
+ * @param value		Pointer to location to store value, 0 or 1
+ *
+ * @returns	0 on success
+ */
+static inline int gpio_get(gpio_line_t *line, int *value)
+{
+	return line->ops->get(line, value);
+}
+
+/**
+ * Wait for an edge on the line
+ *
+ * @param line		GPIO line handle
+ * @param timeout_ms	Maximum time to wait, -1 to wait indefinitely
+ *
+ * @returns	0 on success, also if timed out
+ */
+static inline int gpio_wait(gpio_line_t *line, int timeout_ms)
+{
+	return line->ops->wait(line, timeout_ms);
+}
+
+/**
+ * Release line, if opened
+ *
+ * @param line		GPIO line handle
+ */
+void gpio_close(gpio_line_t *line);
+
+#endif // __GPIO_H__
@@ -26,6 +26,8 @@
  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include "config.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -33,17 +35,44 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <sys/ioctl.h>
 #include <linux/spi/spidev.h>
 
 #include "spi.h"
+#include "spi_sim.h"
 #include "sx1231_ods_error.h"
 #include "sx1231_ods_debug.h"
+#include "sx1231_ods_probes.h"
+#include "sx1231_ods_time.h"
+#include "trace.h"
+
+/**
+ * Open spidev device
+ *
+ * @param spi		SPI device handle to initialize
+ * @param path		Path to spidev device file
+ *
+ * @returns	0 on success
+ */
+static int _spidev_open(spi_dev_t *spi, const char *path);
 
 /**
- * Execute a SPI transfer
+ * Execute a sequence of SPI messages
  *
- * @param fd		File descriptor of SPI device
+ * @param spi		SPI device handle
+ * @param msgs		Messages to execute
+ * @param cnt		Amount of messages
+ *
+ * @returns	0 on success
+ */
+static int _spi_submit(spi_dev_t *spi, const spi_msg_t *msgs, size_t cnt);
+
+/**
+ * Execute a single SPI message
+ *
+ * @param spi		SPI device handle
  * @param do_write	If True, perform a write operation. Else read.
  * @param addr		Register address at which to start operation
  * @param data		Buffer containing data to write or to store read data
@@ -51,66 +80,322 @@
  *
  * @returns	0 on success
  */
-static int _spi_transfer(int fd, bool do_write, uint8_t addr,
+static int _spi_transfer(spi_dev_t *spi, bool do_write, uint8_t addr,
 				uint8_t *data, size_t len);
 
-static int _spi_transfer(int fd, bool do_write, uint8_t addr,
-				uint8_t *data, size_t len)
+static int _spidev_submit(spi_dev_t *spi, const spi_msg_t *msgs, size_t cnt);
+static int _spidev_set_speed(spi_dev_t *spi, uint32_t speed_hz);
+static void _spidev_close(spi_dev_t *spi);
+
+static const spi_ops_t _spidev_ops = {
+	.submit = _spidev_submit,
+	.set_speed = _spidev_set_speed,
+	.close = _spidev_close,
+};
+
+int spi_open(spi_dev_t *spi, const char *path)
+{
+	size_t prefix_len = strlen(SPI_SIM_PATH_PREFIX);
+
+	spi->ops = NULL;
+	spi->fd = -1;
+	spi->priv = NULL;
+	spi->speed_hz = 0;
+	spi->xfer_cnt = 0;
+	spi->xfer_bytes = 0;
+	spi->trace.hdr = NULL;
+
+	if (strncmp(path, SPI_SIM_PATH_PREFIX, prefix_len) == 0) {
+		if (path[prefix_len] == '\0') {
+			return spi_sim_open(spi, NULL);
+		} else if (path[prefix_len] == ':') {
+			return spi_sim_open(spi, &path[prefix_len + 1]);
+		}
+	}
+
+	return _spidev_open(spi, path);
+}
+
+int spi_set_speed(spi_dev_t *spi, uint32_t speed_hz)
 {
-	struct spi_ioc_transfer	xfer[2];
 	int err;
 
-	if (addr & 0x80) {
-		return ERR_INVAL;
+	err = spi->ops->set_speed(spi, speed_hz);
+	if (err != ERR_OK) {
+		return err;
+	}
+	spi->speed_hz = speed_hz;
+
+	DBG_PRINTF(DBG_LVL_MID, "SPI clock speed set to %u Hz\n", speed_hz);
+
+	return ERR_OK;
+}
+
+void spi_close(spi_dev_t *spi)
+{
+	if (spi->ops != NULL) {
+		spi->ops->close(spi);
+		spi->ops = NULL;
+	}
+#ifdef WITH_TRACE
+	trace_close(&spi->trace);
+#endif
+}
+
+static int _spidev_open(spi_dev_t *spi, const char *path)
+{
+	int fd;
+
+	fd = open(path, O_RDWR);
+	if (fd == -1) {
+		return ERR_SPI_OPEN_DEV;
 	}
 
-	memset(xfer, 0, sizeof(xfer));
+	spi->fd = fd;
+	spi->ops = &_spidev_ops;
+
+	// Remember default speed, so it can be restored
+	if (ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, &spi->speed_hz) < 0) {
+		spi->speed_hz = 0;
+	}
+
+	return ERR_OK;
+}
+
+static void _spidev_close(spi_dev_t *spi)
+{
+	close(spi->fd);
+	spi->fd = -1;
+}
 
-	if (do_write) {
-		addr |= 0x80;
+static int _spidev_set_speed(spi_dev_t *spi, uint32_t speed_hz)
+{
+	if (ioctl(spi->fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz) < 0) {
+		perror("SPI_IOC_WR_MAX_SPEED_HZ");
+		return ERR_SPI_IOCTL;
 	}
 
-	// Send (rw // addr)
-	xfer[0].tx_buf = (unsigned long) &addr;
-	xfer[0].len = 1;
+	return ERR_OK;
+}
+
+static int _spidev_submit(spi_dev_t *spi, const spi_msg_t *msgs, size_t cnt)
+{
+	struct spi_ioc_transfer	xfer[SPI_TXN_MAX_MSGS * 2];
+	uint8_t addr[SPI_TXN_MAX_MSGS];
+	size_t i;
+	int err;
+
+	assert(cnt <= SPI_TXN_MAX_MSGS);
+
+	memset(xfer, 0, sizeof(xfer[0]) * cnt * 2);
+
+	for (i = 0; i < cnt; i++) {
+		struct spi_ioc_transfer *xfer_addr = &xfer[i * 2];
+		struct spi_ioc_transfer *xfer_data = &xfer[i * 2 + 1];
+
+		addr[i] = msgs[i].addr;
+		if (msgs[i].do_write) {
+			addr[i] |= 0x80;
+		}
+
+		// Send (rw // addr)
+		xfer_addr->tx_buf = (unsigned long) &addr[i];
+		xfer_addr->len = 1;
+		xfer_addr->speed_hz = spi->speed_hz;
+
+		// Read/Write data
+		if (msgs[i].do_write) {
+			xfer_data->tx_buf = (unsigned long) msgs[i].data;
+		} else {
+			xfer_data->rx_buf = (unsigned long) msgs[i].data;
+		}
+		xfer_data->len = msgs[i].len;
+		xfer_data->speed_hz = spi->speed_hz;
 
-	// Read data
-	if (do_write) {
-		xfer[1].tx_buf = (unsigned long) data;
-	} else {
-		xfer[1].rx_buf = (unsigned long) data;
+		// Deassert chip select between messages
+		if (i != cnt - 1) {
+			xfer_data->cs_change = 1;
+		}
 	}
-	xfer[1].len = len;
 
-	err = ioctl(fd, SPI_IOC_MESSAGE(2), xfer);
+	err = ioctl(spi->fd, SPI_IOC_MESSAGE(cnt * 2), xfer);
 	if (err < 0) {
 		perror("SPI_IOC_MESSAGE");
 		return ERR_SPI_IOCTL;
 	}
 
-	DBG_PRINTF(DBG_LVL_EXTREEM, "SPI %s @ 0x%02x:\n", do_write ? "WRITE" : "READ", addr & 0x7f);
-	DBG_HEXDUMP(DBG_LVL_EXTREEM, data, len);
+	return ERR_OK;
+}
+
+static int _spi_submit(spi_dev_t *spi, const spi_msg_t *msgs, size_t cnt)
+{
+	size_t i;
+	int err;
+#ifdef WITH_TRACE
+	uint64_t start = 0;
+	uint64_t duration;
+#endif
+
+	if (cnt == 0) {
+		return ERR_OK;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		if (msgs[i].addr & 0x80) {
+			return ERR_INVAL;
+		}
+	}
+
+	RF_PROBE3(spi__xfer__start, cnt, msgs[0].addr, msgs[0].len);
+#ifdef WITH_TRACE
+	if (spi->trace.hdr != NULL) {
+		start = time_now_ns();
+	}
+#endif
+	err = spi->ops->submit(spi, msgs, cnt);
+	RF_PROBE2(spi__xfer__done, cnt, err);
+	if (err != ERR_OK) {
+		TRACE(&spi->trace, TRACE_SPI_ERROR, msgs[0].addr, err, NULL, 0);
+		return err;
+	}
+	spi->xfer_cnt++;
+#ifdef WITH_TRACE
+	duration = (start != 0) ? time_now_ns() - start : 0;
+#endif
+
+	for (i = 0; i < cnt; i++) {
+		RF_PROBE3(spi__msg, msgs[i].do_write, msgs[i].addr, msgs[i].len);
+		spi->xfer_bytes += 1 + msgs[i].len;
+#ifdef WITH_TRACE
+		if (spi->trace.hdr != NULL) {
+			// Instead of printing, which delays the next transfer
+			trace_add(&spi->trace, msgs[i].do_write ?
+					TRACE_SPI_WRITE : TRACE_SPI_READ,
+					msgs[i].addr, duration, msgs[i].data,
+					msgs[i].len);
+			continue;
+		}
+#endif
+		DBG_PRINTF(DBG_LVL_EXTREEM, "SPI %s @ 0x%02x:\n", msgs[i].do_write ? "WRITE" : "READ", msgs[i].addr);
+		DBG_HEXDUMP(DBG_LVL_EXTREEM, msgs[i].data, msgs[i].len);
+	}
 
 	return ERR_OK;
 }
 
-int spi_read_reg(int fd, uint8_t addr, uint8_t *data)
+static int _spi_transfer(spi_dev_t *spi, bool do_write, uint8_t addr,
+				uint8_t *data, size_t len)
 {
-	return _spi_transfer(fd, false, addr, data, 1);
+	spi_msg_t msg = {
+		.do_write = do_write,
+		.addr = addr,
+		.data = data,
+		.len = len,
+	};
+
+	return _spi_submit(spi, &msg, 1);
 }
 
-int spi_read_regs(int fd, uint8_t addr, uint8_t *data, size_t len)
+int spi_read_reg(spi_dev_t *spi, uint8_t addr, uint8_t *data)
 {
-	return _spi_transfer(fd, false, addr, data, len);
+	return _spi_transfer(spi, false, addr, data, 1);
 }
 
-int spi_write_reg(int fd, uint8_t addr, uint8_t data)
+int spi_read_regs(spi_dev_t *spi, uint8_t addr, uint8_t *data, size_t len)
 {
-	return _spi_transfer(fd, true, addr, &data, 1);
+	return _spi_transfer(spi, false, addr, data, len);
 }
 
-int spi_write_regs(int fd, uint8_t addr,
+int spi_write_reg(spi_dev_t *spi, uint8_t addr, uint8_t data)
+{
+	return _spi_transfer(spi, true, addr, &data, 1);
+}
+
+int spi_write_regs(spi_dev_t *spi, uint8_t addr,
 		      const uint8_t *data, size_t len)
 {
-	return _spi_transfer(fd, true, addr, (uint8_t *) data, len);
+	return _spi_transfer(spi, true, addr, (uint8_t *) data, len);
+}
+
+void spi_txn_init(spi_txn_t *txn)
+{
+	txn->msg_cnt = 0;
+	txn->buf_len = 0;
+	txn->err = ERR_OK;
+}
+
+/**
+ * Append message to transaction
+ *
+ * @returns	Pointer to new message, or NULL if transaction is full
+ */
+static spi_msg_t *_spi_txn_add(spi_txn_t *txn, bool do_write, uint8_t addr,
+				uint8_t *data, size_t len)
+{
+	spi_msg_t *msg;
+
+	if (txn->msg_cnt >= SPI_TXN_MAX_MSGS) {
+		txn->err = ERR_RANGE;
+		return NULL;
+	}
+
+	msg = &txn->msgs[txn->msg_cnt++];
+	msg->do_write = do_write;
+	msg->addr = addr;
+	msg->data = data;
+	msg->len = len;
+
+	return msg;
+}
+
+void spi_txn_read(spi_txn_t *txn, uint8_t addr, uint8_t *data, size_t len)
+{
+	_spi_txn_add(txn, false, addr, data, len);
+}
+
+void spi_txn_write(spi_txn_t *txn, uint8_t addr, const uint8_t *data, size_t len)
+{
+	_spi_txn_add(txn, true, addr, (uint8_t *) data, len);
+}
+
+void spi_txn_write_reg(spi_txn_t *txn, uint8_t addr, uint8_t data)
+{
+	spi_msg_t *last;
+
+	if (txn->buf_len >= SPI_TXN_BUF_SIZE) {
+		txn->err = ERR_RANGE;
+		return;
+	}
+
+	// Extend previous write if it ends in the buffer right before this
+	// value and targets the preceding register. The FIFO, at address 0,
+	// does not auto-increment.
+	if (txn->msg_cnt != 0) {
+		last = &txn->msgs[txn->msg_cnt - 1];
+		if (last->do_write && last->addr != 0 &&
+				last->data + last->len == &txn->buf[txn->buf_len] &&
+				last->addr + last->len == addr) {
+			txn->buf[txn->buf_len++] = data;
+			last->len++;
+			return;
+		}
+	}
+
+	txn->buf[txn->buf_len] = data;
+	if (_spi_txn_add(txn, true, addr, &txn->buf[txn->buf_len], 1) != NULL) {
+		txn->buf_len++;
+	}
+}
+
+int spi_txn_submit(spi_dev_t *spi, spi_txn_t *txn)
+{
+	int err = txn->err;
+
+	if (err == ERR_OK) {
+		err = _spi_submit(spi, txn->msgs, txn->msg_cnt);
+	}
+
+	spi_txn_init(txn);
+
+	return err;
 }
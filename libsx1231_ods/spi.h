@@ -29,50 +29,240 @@
 #ifndef __SPI_H__
 #define __SPI_H__
 
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "trace.h"
+
+/**
+ * Path prefix selecting the simulated radio backend instead of spidev
+ */
+#define SPI_SIM_PATH_PREFIX "sim"
+
+typedef struct spi_dev spi_dev_t;
+
+/**
+ * Maximum amount of messages in a single SPI transaction
+ */
+#define SPI_TXN_MAX_MSGS 32
+
+/**
+ * Size of buffer for values queued with spi_txn_write_reg()
+ */
+#define SPI_TXN_BUF_SIZE 64
+
+/**
+ * SPI register access message
+ *
+ * A message is a single chip select cycle consisting of the address byte and
+ * one or more data bytes.
+ */
+typedef struct {
+	bool do_write;		/**< If True, perform a write operation */
+	uint8_t addr;		/**< Register address to start operation */
+	uint8_t *data;		/**< Data to write or buffer for read data */
+	size_t len;		/**< Amount of bytes to read/write */
+} spi_msg_t;
+
+/**
+ * SPI transport operations
+ *
+ * Every backend that provides access to the radio registers implements these
+ * operations.
+ */
+typedef struct {
+	/**
+	 * Execute a sequence of register access messages
+	 *
+	 * All messages are executed as a single transfer to the device, with
+	 * chip select deasserted in between messages.
+	 *
+	 * @param spi		SPI device handle
+	 * @param msgs		Messages to execute
+	 * @param cnt		Amount of messages, at most SPI_TXN_MAX_MSGS
+	 *
+	 * @returns	0 on success
+	 */
+	int (*submit)(spi_dev_t *spi, const spi_msg_t *msgs, size_t cnt);
+
+	/**
+	 * Set SPI clock speed
+	 *
+	 * @param spi		SPI device handle
+	 * @param speed_hz	Maximum clock speed in Hz
+	 *
+	 * @returns	0 on success
+	 */
+	int (*set_speed)(spi_dev_t *spi, uint32_t speed_hz);
+
+	/**
+	 * Release all backend resources
+	 *
+	 * @param spi		SPI device handle
+	 */
+	void (*close)(spi_dev_t *spi);
+} spi_ops_t;
+
+/**
+ * SPI device handle
+ */
+struct spi_dev {
+	const spi_ops_t *ops;	/**< Transport backend operations */
+	int fd;			/**< File descriptor of SPI device, -1 if none */
+	void *priv;		/**< Backend private data */
+	uint32_t speed_hz;	/**< SPI clock speed, 0 for driver default */
+	atomic_ulong xfer_cnt;	/**< Amount of transfers(ioctl's) executed */
+	atomic_ulong xfer_bytes; /**< Amount of bytes transferred, incl. address */
+	trace_t trace;		/**< Trace ring for transfers, see trace.h */
+};
+
+/**
+ * SPI transaction
+ *
+ * Collects multiple register reads and writes to be executed using a single
+ * transfer.
+ */
+typedef struct {
+	spi_msg_t msgs[SPI_TXN_MAX_MSGS];	/**< Queued messages */
+	size_t msg_cnt;				/**< Amount of queued messages */
+	uint8_t buf[SPI_TXN_BUF_SIZE];		/**< Storage for queued values */
+	size_t buf_len;				/**< Used bytes in buf */
+	int err;				/**< First error while queueing */
+} spi_txn_t;
+
+/**
+ * Open SPI device
+ *
+ * If path is SPI_SIM_PATH_PREFIX, optionally followed by ':' and backend
+ * arguments, the simulated radio backend is used. Else path is opened as
+ * spidev device.
+ *
+ * @param spi	SPI device handle to initialize
+ * @param path	Path to spidev device file or simulator specification
+ *
+ * @returns	0 on success
+ */
+int spi_open(spi_dev_t *spi, const char *path);
+
+/**
+ * Close SPI device
+ *
+ * @param spi	SPI device handle
+ */
+void spi_close(spi_dev_t *spi);
+
+/**
+ * Set SPI clock speed
+ *
+ * @param spi		SPI device handle
+ * @param speed_hz	Maximum clock speed in Hz
+ *
+ * @returns	0 on success
+ */
+int spi_set_speed(spi_dev_t *spi, uint32_t speed_hz);
+
 /**
  * Read a single byte from SPI device
  *
- * @param fd	File descriptor of SPI device
+ * @param spi	SPI device handle
  * @param addr	Address to read
  * @param data	Pointer to location to store read value
  *
  * @returns	0 on success
  */
-int spi_read_reg(int fd, uint8_t addr, uint8_t *data);
+int spi_read_reg(spi_dev_t *spi, uint8_t addr, uint8_t *data);
 
 /**
  * Burst read multiple bytes from SPI device
  *
- * @param fd	File descriptor of SPI device
+ * @param spi	SPI device handle
  * @param addr	Address to start burst read
  * @param data	Pointer to buffer to store read data
  * @param len	Amount of bytes to read
  *
  * @returns	0 on success
  */
-int spi_read_regs(int fd, uint8_t addr, uint8_t *data, size_t len);
+int spi_read_regs(spi_dev_t *spi, uint8_t addr, uint8_t *data, size_t len);
 
 /**
  * Write a single byte to SPI device
  *
- * @param fd	File descriptor of SPI device
+ * @param spi	SPI device handle
  * @param addr	Target address to write
  * @param data	value to write
  *
  * @returns	0 on success
  */
-int spi_write_reg(int fd, uint8_t addr, uint8_t data);
+int spi_write_reg(spi_dev_t *spi, uint8_t addr, uint8_t data);
 
 /**
  * Burst write multiple bytes to SPI device
  *
- * @param fd	File descriptor of SPI device
+ * @param spi	SPI device handle
  * @param addr	Address to start burst write
  * @param data	Pointer to buffer containing data to write
  * @param len	Amount of bytes to write
  *
  * @returns	0 on success
  */
-int spi_write_regs(int fd, uint8_t addr, const uint8_t *data, size_t len);
+int spi_write_regs(spi_dev_t *spi, uint8_t addr, const uint8_t *data, size_t len);
+
+/**
+ * Initialize an empty SPI transaction
+ *
+ * @param txn	Transaction to initialize
+ */
+void spi_txn_init(spi_txn_t *txn);
+
+/**
+ * Queue a burst read
+ *
+ * The read data is only valid after spi_txn_submit() succeeded.
+ *
+ * @param txn	Transaction to add read to
+ * @param addr	Address to start burst read
+ * @param data	Pointer to buffer to store read data
+ * @param len	Amount of bytes to read
+ */
+void spi_txn_read(spi_txn_t *txn, uint8_t addr, uint8_t *data, size_t len);
+
+/**
+ * Queue a burst write
+ *
+ * The data is not copied and must remain valid until the transaction is
+ * submitted.
+ *
+ * @param txn	Transaction to add write to
+ * @param addr	Address to start burst write
+ * @param data	Pointer to buffer containing data to write
+ * @param len	Amount of bytes to write
+ */
+void spi_txn_write(spi_txn_t *txn, uint8_t addr, const uint8_t *data, size_t len);
+
+/**
+ * Queue a single byte write
+ *
+ * The value is copied into the transaction. Writes to consecutive register
+ * addresses are merged into a single burst write.
+ *
+ * @param txn	Transaction to add write to
+ * @param addr	Target address to write
+ * @param data	value to write
+ */
+void spi_txn_write_reg(spi_txn_t *txn, uint8_t addr, uint8_t data);
+
+/**
+ * Execute all queued messages using a single transfer
+ *
+ * The transaction is emptied afterwards, so it can be reused.
+ *
+ * @param spi	SPI device handle
+ * @param txn	Transaction to execute
+ *
+ * @returns	0 on success, ERR_RANGE if the transaction overflowed
+ */
+int spi_txn_submit(spi_dev_t *spi, spi_txn_t *txn);
 
 #endif // __SPI_H__
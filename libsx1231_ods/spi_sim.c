@@ -0,0 +1,698 @@
+/**
+ * spi_sim.c - Simulated SX1231 SPI backend
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "sx1231_enums.h"
+#include "spi.h"
+#include "spi_sim.h"
+#include "sx1231_ods_error.h"
+#include "sx1231_ods_debug.h"
+#include "sx1231_ods_time.h"
+
+#define SIM_REG_CNT	0x80
+#define SIM_FIFO_SIZE	66
+#define SIM_SYNC_SIZE	8
+
+// Time for one bit is RegBitrate / FXOSC, FXOSC = 32 MHz
+#define SIM_BYTE_TIME_NS(REG) ((uint64_t) (REG) * 8 * NSEC_PER_SEC / 32000000)
+
+// Maximum SPI clock speed supported by SX1231
+#define SIM_MAX_SPI_SPEED_HZ	10000000
+
+#define SIM_DIO_CNT	6
+
+// SPI clock speed used until changed
+#define SIM_DEFAULT_SPI_SPEED_HZ 1000000
+
+// Mode transition timing, see SX1231 datasheet 'Transmitter Timing Diagram'
+#define SIM_TS_OSC_NS	(250 * NSEC_PER_USEC)	// Crystal oscillator wake-up
+#define SIM_TS_FS_NS	(60 * NSEC_PER_USEC)	// Frequency synthesizer wake-up
+#define SIM_TS_TR_NS	(5 * NSEC_PER_USEC)	// Transmitter wake-up, excl. PA ramp
+
+// RegAutoModes conditions, only the ones used for TX are simulated
+#define SIM_AUTO_ENTER_FIFONOTEMPTY	0x1	// Rising edge of FifoNotEmpty
+#define SIM_AUTO_EXIT_PACKETSENT	0x6	// Rising edge of PacketSent
+
+typedef struct {
+	uint8_t regs[SIM_REG_CNT];	/**< Register file */
+
+	uint8_t fifo[SIM_FIFO_SIZE];	/**< FIFO contents */
+	unsigned int fifo_rd;		/**< Index of oldest byte in FIFO */
+	unsigned int fifo_cnt;		/**< Amount of bytes in FIFO */
+	bool fifo_overrun;		/**< FIFO overrun flag */
+
+	int mode;			/**< Current mode, as RegOpMode bits */
+	uint64_t mode_ready_at;		/**< Time at which mode is ready */
+
+	bool shifting;			/**< Transmitter is shifting out data */
+	uint64_t shift_end;		/**< Time at which shift register empties */
+	bool packet_sent;		/**< FIFO ran empty during TX */
+	bool auto_active;		/**< In AutoModes intermediate mode */
+
+	uint64_t xfer_latency;		/**< Simulated duration of a transfer */
+	uint32_t speed_hz;		/**< SPI clock speed, 0 if default */
+
+	unsigned long xfer_cnt;		/**< Amount of SPI transfers */
+	unsigned long tx_bytes;		/**< Amount of bytes transmitted */
+	unsigned long underruns;	/**< Amount of times FIFO ran empty */
+	uint64_t airtime;		/**< Time spend in TX mode, in ns */
+
+	spi_sim_byte_t *log;		/**< Sent bytes, see spi_sim_record() */
+	size_t log_len;			/**< Size of log, in entries */
+	size_t *log_cnt;		/**< Amount of bytes in log */
+} spi_sim_t;
+
+static int _sim_submit(spi_dev_t *spi, const spi_msg_t *msgs, size_t cnt);
+static int _sim_set_speed(spi_dev_t *spi, uint32_t speed_hz);
+static void _sim_close(spi_dev_t *spi);
+
+static const spi_ops_t _sim_ops = {
+	.submit = _sim_submit,
+	.set_speed = _sim_set_speed,
+	.close = _sim_close,
+};
+
+/**
+ * Simulated DIO pin
+ */
+typedef struct {
+	spi_sim_t *sim;		/**< Radio the pin belongs to */
+	int dio;		/**< DIO pin number */
+} sim_dio_t;
+
+static int _sim_dio_get(gpio_line_t *line, int *value);
+static int _sim_dio_wait(gpio_line_t *line, int timeout_ms);
+static void _sim_dio_close(gpio_line_t *line);
+
+static const gpio_ops_t _sim_dio_ops = {
+	.get = _sim_dio_get,
+	.wait = _sim_dio_wait,
+	.close = _sim_dio_close,
+};
+
+/**
+ * PA ramp-up times in microseconds, indexed by RegPaRamp
+ */
+static const uint16_t _sim_pa_ramp_us[16] = {
+	3400, 2000, 1000, 500, 250, 125, 100, 62,
+	50, 40, 31, 25, 20, 15, 12, 10
+};
+
+/**
+ * Set registers to their power-on reset values
+ */
+static void _sim_reset(spi_sim_t *sim)
+{
+	memset(sim->regs, 0, sizeof(sim->regs));
+
+	sim->regs[RegOpMode] = OP_MODE_MODE_STDBY;
+	sim->regs[RegBitrateMsb] = 0x1a;
+	sim->regs[RegBitrateLsb] = 0x0b;
+	sim->regs[RegFdevLsb] = 0x52;
+	sim->regs[RegFrfMsb] = 0xe4;
+	sim->regs[RegFrfMid] = 0xc0;
+	sim->regs[RegOsc1] = 0x41;
+	sim->regs[RegLowBat] = 0x02;
+	sim->regs[RegListen1] = 0x92;
+	sim->regs[RegListen2] = 0xf5;
+	sim->regs[RegListen3] = 0x20;
+	sim->regs[RegVersion] = 0x24;
+	sim->regs[RegPaLevel] = 0x9f;
+	sim->regs[RegPaRamp] = 0x09;
+	sim->regs[RegOcp] = 0x1a;
+	sim->regs[RegLna] = 0x08;
+	sim->regs[RegRxBw] = 0x86;
+	sim->regs[RegAfcBw] = 0x8a;
+	sim->regs[RegOokPeak] = 0x40;
+	sim->regs[RegOokAvg] = 0x80;
+	sim->regs[RegOokFix] = 0x06;
+	sim->regs[RegAfcFei] = 0x10;
+	sim->regs[RegRssiConfig] = 0x02;
+	sim->regs[RegRssiValue] = 0xff;
+	sim->regs[RegDioMapping2] = 0x05;
+	sim->regs[RegRssiThresh] = 0xe4;
+	sim->regs[RegPreambleLsb] = 0x03;
+	sim->regs[RegSyncConfig] = 0x98;
+	memset(&sim->regs[RegSyncValue], 0x01, SIM_SYNC_SIZE);
+	sim->regs[RegPacketConfig1] = 0x10;
+	sim->regs[RegPayloadLength] = 0x40;
+	sim->regs[RegFifoThresh] = 0x0f;
+	sim->regs[RegPacketConfig2] = 0x02;
+	sim->regs[RegTemp1] = 0x01;
+
+	sim->fifo_rd = 0;
+	sim->fifo_cnt = 0;
+	sim->fifo_overrun = false;
+
+	sim->mode = OP_MODE_MODE_STDBY;
+	sim->mode_ready_at = 0;
+
+	sim->shifting = false;
+	sim->packet_sent = false;
+	sim->auto_active = false;
+}
+
+/**
+ * Time it takes to go from one mode to another
+ */
+static uint64_t _sim_mode_delay(spi_sim_t *sim, int from, int to)
+{
+	uint64_t delay = 0;
+
+	if (from == to) {
+		return 0;
+	}
+
+	if (from == OP_MODE_MODE_SLEEP) {
+		delay += SIM_TS_OSC_NS;
+	}
+	if ((from == OP_MODE_MODE_SLEEP || from == OP_MODE_MODE_STDBY) &&
+			to != OP_MODE_MODE_SLEEP &&
+			to != OP_MODE_MODE_STDBY) {
+		delay += SIM_TS_FS_NS;
+	}
+	if (to == OP_MODE_MODE_TX) {
+		delay += SIM_TS_TR_NS;
+		delay += _sim_pa_ramp_us[sim->regs[RegPaRamp] & 0x0f] * NSEC_PER_USEC;
+	}
+
+	return delay;
+}
+
+static uint64_t _sim_byte_time(spi_sim_t *sim)
+{
+	uint16_t reg_bitrate;
+
+	reg_bitrate = (sim->regs[RegBitrateMsb] << 8) | sim->regs[RegBitrateLsb];
+	if (reg_bitrate == 0) {
+		reg_bitrate = 1;
+	}
+
+	return SIM_BYTE_TIME_NS(reg_bitrate);
+}
+
+/**
+ * Time to send one FIFO byte, Manchester encoding doubles it
+ */
+static uint64_t _sim_data_byte_time(spi_sim_t *sim)
+{
+	if ((sim->regs[RegPacketConfig1] & 0x60) ==
+			PACKET_CONFIG1_DCFREE_MANCHESTER) {
+		return 2 * _sim_byte_time(sim);
+	}
+
+	return _sim_byte_time(sim);
+}
+
+/**
+ * Time to send preamble and sync word, before the first FIFO byte
+ */
+static uint64_t _sim_header_time(spi_sim_t *sim)
+{
+	unsigned int len;
+
+	len = (sim->regs[RegPreambleMsb] << 8) | sim->regs[RegPreambleLsb];
+	if (sim->regs[RegSyncConfig] & SYNC_CONFIG_SYNCON) {
+		len += ((sim->regs[RegSyncConfig] >> 3) & 0x7) + 1;
+	}
+
+	return len * _sim_byte_time(sim);
+}
+
+static void _sim_set_mode(spi_sim_t *sim, int mode, uint64_t now);
+
+/**
+ * Handle AutoModes enter and exit conditions
+ *
+ * @param sim	Simulator state
+ * @param enter	Enter condition that occurred, or 0
+ * @param exit	Exit condition that occurred, or 0
+ * @param now	Time at which condition occurred
+ */
+static void _sim_auto_modes(spi_sim_t *sim, int enter, int exit, uint64_t now)
+{
+	static const int modes[4] = {
+		OP_MODE_MODE_SLEEP, OP_MODE_MODE_STDBY,
+		OP_MODE_MODE_RX, OP_MODE_MODE_TX
+	};
+	uint8_t reg = sim->regs[RegAutoModes];
+
+	if (!sim->auto_active && enter != 0 && ((reg >> 5) & 0x7) == enter) {
+		DBG_PRINTF(DBG_LVL_HIGH, "SIM: enter intermediate mode\n");
+		_sim_set_mode(sim, modes[reg & 0x3], now);
+		sim->auto_active = true;
+	} else if (sim->auto_active && exit != 0 &&
+			((reg >> 2) & 0x7) == exit) {
+		DBG_PRINTF(DBG_LVL_HIGH, "SIM: exit intermediate mode\n");
+		sim->auto_active = false;
+		_sim_set_mode(sim, sim->regs[RegOpMode] & 0x1c, now);
+	}
+}
+
+static bool _sim_tx_start_cond(spi_sim_t *sim)
+{
+	if (sim->regs[RegFifoThresh] & 0x80) {
+		return (sim->fifo_cnt != 0);
+	} else {
+		return (sim->fifo_cnt > (sim->regs[RegFifoThresh] & 0x7f));
+	}
+}
+
+/**
+ * Advance transmitter state to the given time
+ */
+static void _sim_update(spi_sim_t *sim, uint64_t now)
+{
+	uint64_t byte_time;
+
+	if (sim->mode != OP_MODE_MODE_TX || now < sim->mode_ready_at) {
+		return;
+	}
+
+	if (!sim->shifting && !sim->packet_sent && _sim_tx_start_cond(sim)) {
+		// Transmitter became ready with data waiting
+		sim->shifting = true;
+		sim->shift_end = sim->mode_ready_at + _sim_header_time(sim);
+	}
+
+	byte_time = _sim_data_byte_time(sim);
+	while (sim->shifting && sim->shift_end <= now) {
+		if (sim->fifo_cnt != 0) {
+			if (sim->log != NULL && *sim->log_cnt < sim->log_len) {
+				sim->log[*sim->log_cnt].val =
+						sim->fifo[sim->fifo_rd];
+				sim->log[*sim->log_cnt].start = sim->shift_end;
+				(*sim->log_cnt)++;
+			}
+			sim->fifo_rd = (sim->fifo_rd + 1) % SIM_FIFO_SIZE;
+			sim->fifo_cnt--;
+			sim->shift_end += byte_time;
+			sim->tx_bytes++;
+		} else {
+			sim->shifting = false;
+			sim->packet_sent = true;
+			_sim_auto_modes(sim, 0, SIM_AUTO_EXIT_PACKETSENT,
+					sim->shift_end);
+		}
+	}
+}
+
+/**
+ * Start transmitter if it is waiting for data
+ */
+static void _sim_kick(spi_sim_t *sim, uint64_t now)
+{
+	if (sim->mode != OP_MODE_MODE_TX || now < sim->mode_ready_at) {
+		return;
+	}
+	if (sim->shifting || !_sim_tx_start_cond(sim)) {
+		return;
+	}
+
+	sim->shifting = true;
+	sim->shift_end = now;
+	if (sim->packet_sent) {
+		// FIFO ran empty before, data is no longer continuous
+		sim->underruns++;
+		sim->packet_sent = false;
+		DBG_PRINTF(DBG_LVL_HIGH, "SIM: FIFO underrun\n");
+	} else {
+		// Start of packet
+		sim->shift_end += _sim_header_time(sim);
+	}
+	_sim_update(sim, now);
+}
+
+static void _sim_set_mode(spi_sim_t *sim, int mode, uint64_t now)
+{
+	if (mode == sim->mode) {
+		return;
+	}
+
+	DBG_PRINTF(DBG_LVL_HIGH, "SIM: mode 0x%02x -> 0x%02x\n", sim->mode, mode);
+
+	if (sim->mode == OP_MODE_MODE_TX) {
+		if (now > sim->mode_ready_at) {
+			sim->airtime += now - sim->mode_ready_at;
+		}
+		sim->shifting = false;
+		sim->packet_sent = false;
+	}
+
+	sim->mode_ready_at = now + _sim_mode_delay(sim, sim->mode, mode);
+	sim->mode = mode;
+}
+
+static uint8_t _sim_read_reg(spi_sim_t *sim, uint8_t addr, uint64_t now)
+{
+	uint8_t val;
+	bool ready = (now >= sim->mode_ready_at);
+
+	switch (addr) {
+	case RegFifo:
+		// Receive path is not simulated
+		return 0;
+	case RegIrqFlags1:
+		val = 0;
+		if (ready) {
+			val |= IRQ_FLAGS1_MODEREADY;
+			if (sim->mode == OP_MODE_MODE_TX) {
+				val |= IRQ_FLAGS1_TXREADY;
+			}
+			if (sim->mode == OP_MODE_MODE_FS ||
+					sim->mode == OP_MODE_MODE_TX) {
+				val |= IRQ_FLAGS1_PLLLOCK;
+			}
+		}
+		if (sim->auto_active) {
+			val |= IRQ_FLAGS1_AUTOMODE;
+		}
+		return val;
+	case RegIrqFlags2:
+		val = 0;
+		if (sim->fifo_cnt == SIM_FIFO_SIZE) {
+			val |= IRQ_FLAGS2_FIFOFULL;
+		}
+		if (sim->fifo_cnt != 0) {
+			val |= IRQ_FLAGS2_FIFONOTEMPTY;
+		}
+		if (sim->fifo_cnt > (sim->regs[RegFifoThresh] & 0x7f)) {
+			val |= IRQ_FLAGS2_FIFOLEVEL;
+		}
+		if (sim->fifo_overrun) {
+			val |= IRQ_FLAGS2_FIFOOVERRUN;
+		}
+		if (sim->packet_sent) {
+			val |= IRQ_FLAGS2_PACKETSENT;
+		}
+		return val;
+	default:
+		return sim->regs[addr];
+	}
+}
+
+static void _sim_write_reg(spi_sim_t *sim, uint8_t addr, uint8_t val,
+				uint64_t now)
+{
+	switch (addr) {
+	case RegFifo:
+		if (sim->fifo_cnt == SIM_FIFO_SIZE) {
+			sim->fifo_overrun = true;
+			DBG_PRINTF(DBG_LVL_HIGH, "SIM: FIFO overrun\n");
+			break;
+		}
+		sim->fifo[(sim->fifo_rd + sim->fifo_cnt) % SIM_FIFO_SIZE] = val;
+		sim->fifo_cnt++;
+		if (sim->fifo_cnt == 1) {
+			_sim_auto_modes(sim, SIM_AUTO_ENTER_FIFONOTEMPTY, 0, now);
+		}
+		_sim_kick(sim, now);
+		break;
+	case RegOpMode:
+		sim->regs[addr] = val;
+		if (!sim->auto_active) {
+			_sim_set_mode(sim, val & 0x1c, now);
+		}
+		break;
+	case RegAutoModes:
+		sim->regs[addr] = val;
+		// Disabling automatic modes leaves the intermediate mode
+		if (sim->auto_active && (val >> 5) == 0) {
+			DBG_PRINTF(DBG_LVL_HIGH, "SIM: exit intermediate mode\n");
+			sim->auto_active = false;
+			_sim_set_mode(sim, sim->regs[RegOpMode] & 0x1c, now);
+		}
+		break;
+	case RegIrqFlags2:
+		// Writing FifoOverrun clears the FIFO
+		if (val & IRQ_FLAGS2_FIFOOVERRUN) {
+			sim->fifo_cnt = 0;
+			sim->fifo_overrun = false;
+		}
+		break;
+	case RegVersion:
+	case RegIrqFlags1:
+	case RegRssiValue:
+	case RegAfcMsb:
+	case RegAfcLsb:
+	case RegFeiMsb:
+	case RegFeiLsb:
+	case RegTemp2:
+		// Read-only
+		break;
+	default:
+		sim->regs[addr] = val;
+		break;
+	}
+}
+
+int spi_sim_open(spi_dev_t *spi, const char *args)
+{
+	spi_sim_t *sim;
+	unsigned long latency_us = 0;
+	char *endp;
+
+	if (args != NULL && *args != '\0') {
+		latency_us = strtoul(args, &endp, 0);
+		if (*endp != '\0') {
+			return ERR_INVAL;
+		}
+	}
+
+	sim = (spi_sim_t *) calloc(1, sizeof(spi_sim_t));
+	if (sim == NULL) {
+		return ERR_UNSPEC;
+	}
+
+	_sim_reset(sim);
+	sim->xfer_latency = latency_us * NSEC_PER_USEC;
+	sim->speed_hz = SIM_DEFAULT_SPI_SPEED_HZ;
+
+	spi->fd = -1;
+	spi->speed_hz = SIM_DEFAULT_SPI_SPEED_HZ;
+	spi->priv = sim;
+	spi->ops = &_sim_ops;
+
+	return ERR_OK;
+}
+
+static void _sim_close(spi_dev_t *spi)
+{
+	spi_sim_t *sim = (spi_sim_t *) spi->priv;
+
+	_sim_set_mode(sim, OP_MODE_MODE_SLEEP, time_now_ns());
+
+	DBG_PRINTF(DBG_LVL_LOW, "SIM: %lu transfers, %lu bytes transmitted, "
+			"%lu underruns, %.3f ms airtime\n",
+			sim->xfer_cnt, sim->tx_bytes, sim->underruns,
+			sim->airtime / 1e6);
+
+	free(sim);
+	spi->priv = NULL;
+}
+
+static int _sim_set_speed(spi_dev_t *spi, uint32_t speed_hz)
+{
+	spi_sim_t *sim = (spi_sim_t *) spi->priv;
+
+	sim->speed_hz = speed_hz;
+
+	return ERR_OK;
+}
+
+static int _sim_submit(spi_dev_t *spi, const spi_msg_t *msgs, size_t cnt)
+{
+	spi_sim_t *sim = (spi_sim_t *) spi->priv;
+	uint64_t now;
+	uint8_t addr;
+	size_t i, j;
+
+	if (sim->xfer_latency != 0) {
+		time_sleep_until_ns(time_now_ns() + sim->xfer_latency);
+	}
+
+	now = time_now_ns();
+	_sim_update(sim, now);
+
+	for (i = 0; i < cnt; i++) {
+		addr = msgs[i].addr;
+		for (j = 0; j < msgs[i].len; j++) {
+			if (msgs[i].do_write) {
+				_sim_write_reg(sim, addr, msgs[i].data[j], now);
+			} else {
+				msgs[i].data[j] = _sim_read_reg(sim, addr, now);
+
+				// Above the maximum clock speed MISO is
+				// sampled a bit too late
+				if (sim->speed_hz > SIM_MAX_SPI_SPEED_HZ) {
+					msgs[i].data[j] <<= 1;
+				}
+			}
+
+			// Burst access auto-increments address, except for FIFO
+			if (addr != RegFifo) {
+				addr = (addr + 1) % SIM_REG_CNT;
+			}
+		}
+	}
+
+	sim->xfer_cnt++;
+
+	return ERR_OK;
+}
+
+int spi_sim_record(spi_dev_t *spi, spi_sim_byte_t *log, size_t len,
+			size_t *cnt)
+{
+	spi_sim_t *sim = (spi_sim_t *) spi->priv;
+
+	if (spi->ops != &_sim_ops || (log != NULL && cnt == NULL)) {
+		return ERR_INVAL;
+	}
+
+	// Bytes sent till now belong to the previous recording
+	_sim_update(sim, time_now_ns());
+
+	sim->log = log;
+	sim->log_len = len;
+	sim->log_cnt = cnt;
+	if (cnt != NULL) {
+		*cnt = 0;
+	}
+
+	return ERR_OK;
+}
+
+int spi_sim_open_dio(spi_dev_t *spi, gpio_line_t *line, int dio)
+{
+	sim_dio_t *sim_dio;
+
+	if (spi->ops != &_sim_ops || dio < 0 || dio >= SIM_DIO_CNT) {
+		return ERR_INVAL;
+	}
+
+	sim_dio = (sim_dio_t *) calloc(1, sizeof(sim_dio_t));
+	if (sim_dio == NULL) {
+		return ERR_UNSPEC;
+	}
+	sim_dio->sim = (spi_sim_t *) spi->priv;
+	sim_dio->dio = dio;
+
+	line->fd = -1;
+	line->priv = sim_dio;
+	line->ops = &_sim_dio_ops;
+
+	return ERR_OK;
+}
+
+static int _sim_dio_get(gpio_line_t *line, int *value)
+{
+	sim_dio_t *sim_dio = (sim_dio_t *) line->priv;
+	spi_sim_t *sim = sim_dio->sim;
+	uint64_t now = time_now_ns();
+	uint8_t irq1, irq2;
+	int mapping;
+
+	_sim_update(sim, now);
+	irq1 = _sim_read_reg(sim, RegIrqFlags1, now);
+	irq2 = _sim_read_reg(sim, RegIrqFlags2, now);
+
+	// Only the packet mode TX mappings are simulated
+	*value = 0;
+	switch (sim_dio->dio) {
+	case 0:
+		mapping = (sim->regs[RegDioMapping1] >> 6) & 0x3;
+		if (mapping == 0) {
+			*value = !!(irq2 & IRQ_FLAGS2_PACKETSENT);
+		} else if (mapping == 1) {
+			*value = !!(irq1 & IRQ_FLAGS1_TXREADY);
+		}
+		break;
+	case 1:
+		mapping = (sim->regs[RegDioMapping1] >> 4) & 0x3;
+		if (mapping == 0) {
+			*value = !!(irq2 & IRQ_FLAGS2_FIFOLEVEL);
+		} else if (mapping == 1) {
+			*value = !!(irq2 & IRQ_FLAGS2_FIFOFULL);
+		} else if (mapping == 2) {
+			*value = !!(irq2 & IRQ_FLAGS2_FIFONOTEMPTY);
+		}
+		break;
+	case 5:
+		mapping = (sim->regs[RegDioMapping2] >> 4) & 0x3;
+		if (mapping == 3) {
+			*value = !!(irq1 & IRQ_FLAGS1_MODEREADY);
+		}
+		break;
+	default:
+		break;
+	}
+
+	return ERR_OK;
+}
+
+static int _sim_dio_wait(gpio_line_t *line, int timeout_ms)
+{
+	sim_dio_t *sim_dio = (sim_dio_t *) line->priv;
+	spi_sim_t *sim = sim_dio->sim;
+	uint64_t now = time_now_ns();
+	uint64_t wake;
+
+	_sim_update(sim, now);
+
+	// Wake up at the next simulated state change. If nothing is pending
+	// only sleep briefly, the host might change state in the meantime.
+	if (now < sim->mode_ready_at) {
+		wake = sim->mode_ready_at;
+	} else if (sim->shifting) {
+		wake = sim->shift_end;
+	} else {
+		wake = now + NSEC_PER_MSEC;
+	}
+
+	if (timeout_ms >= 0 && wake > now + timeout_ms * NSEC_PER_MSEC) {
+		wake = now + timeout_ms * NSEC_PER_MSEC;
+	}
+
+	time_sleep_until_ns(wake);
+
+	return ERR_OK;
+}
+
+static void _sim_dio_close(gpio_line_t *line)
+{
+	free(line->priv);
+	line->priv = NULL;
+}
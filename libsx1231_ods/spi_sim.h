@@ -0,0 +1,94 @@
+/**
+ * spi_sim.h - Simulated SX1231 SPI backend
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __SPI_SIM_H__
+#define __SPI_SIM_H__
+
+#include "spi.h"
+#include "gpio.h"
+
+/**
+ * Open simulated SX1231 radio
+ *
+ * The simulator models the SX1231 register file, the FIFO draining at the
+ * configured bit rate, the interrupt flags and the mode transition timing in
+ * real time. This allows the library to be exercised without hardware.
+ *
+ * Arguments are of the form '<latency>', where latency is the time in
+ * microseconds that every SPI transfer takes. If args is NULL or empty
+ * transfers complete immediately.
+ *
+ * @param spi	SPI device handle to initialize
+ * @param args	Backend arguments, or NULL
+ *
+ * @returns	0 on success
+ */
+int spi_sim_open(spi_dev_t *spi, const char *args);
+
+/**
+ * Byte sent by the simulated radio
+ */
+typedef struct {
+	uint8_t val;		/**< Byte value, as written to the FIFO */
+	uint64_t start;		/**< Time the first bit was sent, in ns */
+} spi_sim_byte_t;
+
+/**
+ * Record the bytes sent by a simulated radio
+ *
+ * Every FIFO byte the transmitter shifts out is appended to 'log', till
+ * 'len' bytes are recorded. The simulator advances on SPI transfers, so the
+ * last bytes of a transmission show up once the library noticed it ended,
+ * eg. after rf_flush().
+ *
+ * @param spi	SPI device handle of simulated radio
+ * @param log	Buffer to record bytes in, or NULL to stop recording
+ * @param len	Size of log, in entries
+ * @param cnt	Set to 0, and incremented for every recorded byte
+ *
+ * @returns	0 on success, ERR_INVAL if spi is not a simulated radio
+ */
+int spi_sim_record(spi_dev_t *spi, spi_sim_byte_t *log, size_t len,
+			size_t *cnt);
+
+/**
+ * Open a DIO pin of the simulated radio
+ *
+ * The pin level follows the simulated interrupt flags according to
+ * RegDioMapping1/2. Waiting on the pin sleeps till the next simulated
+ * change of the FIFO or mode state.
+ *
+ * @param spi	SPI device handle of simulated radio
+ * @param line	GPIO line handle to initialize
+ * @param dio	DIO pin number, 0 to 5
+ *
+ * @returns	0 on success, ERR_INVAL if spi is not a simulated radio
+ */
+int spi_sim_open_dio(spi_dev_t *spi, gpio_line_t *line, int dio);
+
+#endif // __SPI_SIM_H__
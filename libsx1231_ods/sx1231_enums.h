@@ -110,6 +110,12 @@ enum {
 	OP_MODE_MODE_RX		= (0x04 << 2),
 };
 
+// RegSyncConfig
+enum {
+	SYNC_CONFIG_SYNCON			= 0x80,
+	SYNC_CONFIG_FIFOFILLCONDITION		= 0x40,
+};
+
 // RegPacketConfig1
 enum {
 	PACKET_CONFIG1_PACKETFORMAT		= 0x80,
@@ -31,20 +31,32 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <math.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <sys/timerfd.h>
 
 #include "sx1231_enums.h"
 #include "sx1231_ods.h"
 #include "spi.h"
+#include "spi_sim.h"
+#include "gpio.h"
+#include "sx1231_ods_time.h"
+#include "sx1231_ods_probes.h"
 
 #define SX1231_FIFO_SIZE 66
+#define SX1231_SYNC_SIZE 8
 
 #ifndef SX1231_FXOSC
 # define SX1231_FXOSC (32.0 * 1e6)
@@ -52,35 +64,282 @@
 
 #define SX1231_FSTEP (SX1231_FXOSC / 0x80000)
 
+// Time to transmit a byte in ns, for given RegBitrate value
+#define SX1231_BYTE_TIME_NS(REG) ((uint64_t) (REG) * 8 * NSEC_PER_SEC / SX1231_FXOSC)
+
+#define PREDICT_MARGIN		2	// FIFO bytes kept free for prediction errors
+#define PREDICT_CHECK_INTERVAL	8	// Refills between FIFO level checks
+
+#define WAIT_SPIN_NS		(50 * NSEC_PER_USEC)	// Spin time before sleeping
+#define WAIT_SLICE_MIN_NS	(10 * NSEC_PER_USEC)	// Min. sleep between polls
+#define WAIT_SLICE_MAX_NS	(1 * NSEC_PER_MSEC)	// Max. sleep between polls
+#define WAIT_MARGIN_MIN_NS	(10 * NSEC_PER_USEC)	// Min. early wake-up
+#define WAIT_MARGIN_MAX_NS	(1 * NSEC_PER_MSEC)	// Max. early wake-up
+#define WAIT_TIMEOUT_NS		(10 * NSEC_PER_MSEC)	// Slack on wait deadlines
+
+// RegAutoModes: enter on rising FifoNotEmpty, exit on rising PacketSent,
+// intermediate mode TX
+#define AUTO_MODES_TX		((0x1 << 5) | (0x6 << 2) | 0x3)
+
+// Mode transition timing, see SX1231 datasheet 'Transmitter Timing Diagram'
+#define SX1231_TS_OSC_NS	(250 * NSEC_PER_USEC)
+#define SX1231_TS_FS_NS		(60 * NSEC_PER_USEC)
+#define SX1231_TS_TR_NS		(5 * NSEC_PER_USEC)
+
+/**
+ * PA ramp-up times in microseconds, indexed by RegPaRamp
+ */
+static const uint16_t _pa_ramp_us[16] = {
+	3400, 2000, 1000, 500, 250, 125, 100, 62,
+	50, 40, 31, 25, 20, 15, 12, 10
+};
+
+// Adaptive idle policy: park in FS or standby if sends are more frequent
+#define IDLE_FS_INTERVAL_NS	(100 * NSEC_PER_MSEC)
+#define IDLE_STDBY_INTERVAL_NS	(10 * NSEC_PER_SEC)
+
+// Steps of a non-blocking transmission
+#define TX_STATE_IDLE	0	// No transmission in progress
+#define TX_STATE_FLUSH	1	// Waiting for previous transmission to end
+#define TX_STATE_START	2	// Waiting to prefill FIFO and start TX
+#define TX_STATE_REFILL	3	// Waiting for space in FIFO
+#define TX_STATE_DRAIN	4	// Waiting for PacketSent
+
+#define SHADOW_SYNC_FIRST	RegOpMode	// First register read at open
+#define SHADOW_SYNC_LAST	RegPacketConfig2 // Last register read at open
+
+#define SPI_PROBE_ROUNDS 16	// Amount of pattern checks per probed speed
+
+#define TUNE_MIN_SAMPLES	16	// Refill latency samples before tuning
+#define TUNE_THRESH_DEFAULT	15	// FIFO threshold till enough samples
+#define TUNE_THRESH_MIN		1	// Min. FIFO threshold
+#define TUNE_THRESH_MAX		(SX1231_FIFO_SIZE - 8) // Max. FIFO threshold
+
+/**
+ * SPI clock speeds to probe, in Hz. Highest is SX1231 maximum.
+ */
+static const uint32_t _spi_probe_speeds[] = {
+	10000000, 8000000, 6000000, 5000000, 4000000,
+	2000000, 1000000, 500000, 250000, 100000
+};
+
 unsigned int debug_level = 0;
 
 static int _reset(rf_dev_t *dev);
+static void _recover(rf_dev_t *dev, int err);
 static int _sync_config(rf_dev_t *dev);
+static bool _reg_is_volatile(uint8_t reg);
 static int _switch_mode(rf_dev_t *dev, int mode);
+static int _switch_mode_txn(rf_dev_t *dev, spi_txn_t *txn, int mode);
+static void _profile_init(rf_profile_t *prof);
+static void _profile_set_regs(rf_profile_t *prof, uint8_t reg,
+				const uint8_t *vals, size_t len);
+static void _profile_set_reg(rf_profile_t *prof, uint8_t reg, uint8_t val);
+static int _profile_set_pa(rf_profile_t *prof, uint8_t level, bool pa1_on);
+static int _profile_set_frequency(rf_profile_t *prof, double freq_mhz);
+static int _profile_set_bitrate(rf_profile_t *prof, double data_rate_kbps);
+static int _profile_set_modulation(rf_profile_t *prof, int modulation);
+static int _profile_set_fdev(rf_profile_t *prof, double fdev_khz);
+static int _profile_set_framing(rf_profile_t *prof,
+				const rf_framing_t *framing);
+static bool _framing_enabled(rf_dev_t *dev);
+static void _txn_apply_profile(rf_dev_t *dev, spi_txn_t *txn,
+				const rf_profile_t *prof);
+static bool _profile_is_applied(rf_dev_t *dev, const rf_profile_t *prof);
+static void _txn_write_shadow(rf_dev_t *dev, spi_txn_t *txn, uint8_t reg,
+				const uint8_t *vals, size_t len);
+static void _txn_write_shadow_reg(rf_dev_t *dev, spi_txn_t *txn, uint8_t reg,
+				uint8_t val);
+static int _shadow_submit(rf_dev_t *dev, spi_txn_t *txn);
+static bool _shadow_is(rf_dev_t *dev, uint8_t reg, uint8_t val);
+static void _update_byte_time(rf_dev_t *dev);
+static int _wait_flag(rf_dev_t *dev, uint8_t reg, uint8_t flag, bool set,
+				uint64_t expect, uint64_t deadline);
+static uint64_t _wait_deadline(rf_dev_t *dev, uint64_t expect, size_t bytes);
+static void _wait_until(rf_dev_t *dev, uint64_t deadline);
+
+/**
+ * Source of data to transmit
+ *
+ * Allows rf_sendv() and rf_send_train() to share the FIFO refill loops,
+ * without first gathering all data in a buffer.
+ */
+typedef struct tx_source {
+	/**
+	 * Copy next bytes to buf
+	 *
+	 * @param src	Data source
+	 * @param buf	Buffer to copy bytes to
+	 * @param len	Amount of bytes to copy, at most remaining
+	 */
+	void (*read)(struct tx_source *src, uint8_t *buf, size_t len);
+	size_t remaining;	/**< Amount of bytes left */
+} tx_source_t;
+
+/**
+ * Data source for a list of buffers
+ */
+typedef struct {
+	tx_source_t src;
+	const struct iovec *iov; /**< Current segment */
+	size_t offset;		/**< Offset of next byte in current segment */
+} iov_source_t;
+
+/**
+ * Data source rendering a frame train
+ */
+typedef struct {
+	tx_source_t src;
+	const rf_train_entry_t *entries; /**< Train entries */
+	size_t cnt;		/**< Amount of train entries */
+	size_t entry;		/**< Current entry */
+	unsigned int repeat;	/**< Repeats of current entry done */
+	bool in_gap;		/**< Rendering gap after frame */
+	int seg;		/**< Current segment of frame */
+	size_t bit;		/**< Bit offset in current segment or gap */
+	size_t gap_bits;	/**< Length of current gap, in bits */
+	uint64_t byte_time;	/**< Time to transmit one byte, in ns */
+} train_source_t;
+
+static int _tx_prepare(rf_dev_t *dev, uint64_t deadline, uint64_t *start,
+				int *idle);
+static int _tx_start(rf_dev_t *dev, spi_txn_t *txn, uint64_t start,
+				uint64_t *tx_start);
+static int _tx_finish(rf_dev_t *dev, int idle);
+static int _send(rf_dev_t *dev, tx_source_t *src, uint64_t deadline);
+static int _send_train_framed(rf_dev_t *dev, const rf_train_entry_t *entries,
+				size_t cnt);
+static int _stream_start(rf_dev_t *dev);
+static int _stream_refill(rf_dev_t *dev, bool block);
+static int _stream_refill_predicted(rf_dev_t *dev, bool block);
+static int _fifo_refill(rf_dev_t *dev, const uint8_t *buf, size_t len,
+				unsigned int headroom);
+static unsigned int _refill_headroom(rf_dev_t *dev, uint64_t mark);
+static void _stats_inc(atomic_ulong *cnt);
+static void _stats_refill(rf_dev_t *dev, unsigned int headroom);
+static void _stats_send(rf_dev_t *dev, uint64_t start, size_t len);
+static void _hist_add(atomic_ulong *hist, uint64_t sample);
+static void _stream_abort(rf_dev_t *dev);
+static int _tx_sm_step(rf_dev_t *dev, uint64_t now);
+static void _tx_sm_expect_drop(rf_dev_t *dev);
+static int _tx_sm_repoll(rf_dev_t *dev, uint64_t now);
+static int _tx_sm_arm(rf_dev_t *dev);
+static uint64_t _wait_margin(rf_dev_t *dev);
+static void _tx_sm_abort(rf_dev_t *dev);
+static uint64_t _wait_slice(rf_dev_t *dev);
+static void _wait_trigger(rf_dev_t *dev, uint64_t trigger);
+static int _send_polled(rf_dev_t *dev, tx_source_t *src, size_t prefill_len,
+				uint64_t tx_start);
+static int _send_predicted(rf_dev_t *dev, tx_source_t *src, size_t prefill_len,
+				uint64_t tx_start);
+static void _source_read(tx_source_t *src, uint8_t *buf, size_t len);
+static size_t _iov_len(const struct iovec *iov, int iovcnt);
+static void _iov_source_init(iov_source_t *is, const struct iovec *iov,
+				int iovcnt);
+static void _train_source_init(train_source_t *ts,
+				const rf_train_entry_t *entries, size_t cnt,
+				uint64_t byte_time);
+static uint64_t _tx_startup_time(rf_dev_t *dev);
+static int _flush(rf_dev_t *dev);
+static int _idle_mode(rf_dev_t *dev);
+static void _update_send_interval(rf_dev_t *dev, uint64_t now);
+static int _lock(rf_dev_t *dev);
+static void _lock_gen_map(rf_dev_t *dev);
+static void _unlock(rf_dev_t *dev);
+static int _restore_config(rf_dev_t *dev);
+static bool _config_changed(rf_dev_t *dev, const uint8_t *regs,
+				uint8_t first, uint8_t last);
+
+/**
+ * Model of the FIFO contents during transmission
+ */
+typedef struct {
+	uint64_t start;		/**< Time at which transmission started */
+	uint64_t byte_time;	/**< Time to transmit one byte, in ns */
+	size_t written;		/**< Bytes written to FIFO since start */
+} fifo_model_t;
+static size_t _fifo_model_level(const fifo_model_t *model, uint64_t now);
+static uint64_t _fifo_model_time_at(const fifo_model_t *model, size_t level);
+static void _fifo_model_correct(fifo_model_t *model, uint64_t now,
+				size_t level);
+static int _predict_refill(rf_dev_t *dev, fifo_model_t *model,
+				const uint8_t *buf, size_t len, uint64_t due,
+				unsigned int refill_cnt);
 static void _dump_status(rf_dev_t *dev);
+static void _latency_add(rf_latency_t *stats, uint64_t sample);
+static void _latency_add_shared(rf_dev_t *dev, rf_latency_t *stats,
+				uint64_t sample);
+static void _set_fifo_thresh(rf_dev_t *dev, uint8_t thresh);
+static uint8_t _choose_fifo_thresh(rf_dev_t *dev);
+static int _tune_fifo_thresh(rf_dev_t *dev);
+static int _auto_spi_speed(rf_dev_t *dev, const char *spi_path);
+static int _probe_spi_speed(rf_dev_t *dev, const uint32_t *speeds, size_t cnt,
+				uint32_t *speed_hz);
 
-int rf_open(rf_dev_t *dev, const char *spi_path)
+int rf_open(rf_dev_t *dev, const char *spi_path, uint32_t spi_speed_hz)
 {
 	int err = ERR_UNSPEC;
-	int fd;
-	uint8_t val;
 
-	fd = open(spi_path, O_RDWR);
-	if (fd == -1) {
-		return ERR_SPI_OPEN_DEV;
+	err = spi_open(&dev->spi, spi_path);
+	if (err != ERR_OK) {
+		return err;
 	}
 
-	dev->fd = fd;
+	pthread_mutex_init(&dev->lock, NULL);
+	pthread_cond_init(&dev->lock_cond, NULL);
+	dev->lock_next = 0;
+	dev->lock_serving = 0;
+	dev->lock_depth = 0;
+	dev->flock_held = false;
+	dev->lock_gen_shared = NULL;
+	dev->lock_wait = 0;
+	memset(&dev->lock_wait_stats, 0, sizeof(dev->lock_wait_stats));
+	memset(&dev->stats, 0, sizeof(dev->stats));
+	dev->stats.min_headroom = UINT_MAX;
+
+	dev->refill_mode = RF_REFILL_POLL;
+	dev->wait_strategy = RF_WAIT_SPIN;
+	memset(dev->wait_stats, 0, sizeof(dev->wait_stats));
+	memset(&dev->refill_latency, 0, sizeof(dev->refill_latency));
+	dev->underrun_prob = RF_UNDERRUN_PROB_DEFAULT;
+	memset(dev->shadow_valid, 0, sizeof(dev->shadow_valid));
+	dev->auto_modes = false;
+	dev->tx_pending = false;
+	dev->idle_policy = RF_IDLE_STDBY;
+	dev->last_send = 0;
+	dev->send_interval = 0;
+	memset(dev->tx_start_latency, 0, sizeof(dev->tx_start_latency));
+	memset(&dev->trigger_latency, 0, sizeof(dev->trigger_latency));
+	dev->start_error = 0;
+	memset(&dev->start_error_abs, 0, sizeof(dev->start_error_abs));
+	dev->stream.active = false;
+	dev->last_tx_start = 0;
+	dev->async = NULL;
+	dev->tx_sm.state = TX_STATE_IDLE;
+	dev->tx_sm.fd = -1;
+	for (int i = 0; i < RF_DIO_CNT; i++) {
+		dev->dio[i].ops = NULL;
+	}
+
+	if (spi_speed_hz != RF_SPI_SPEED_DEFAULT &&
+			spi_speed_hz != RF_SPI_SPEED_AUTO) {
+		TRY(spi_set_speed(&dev->spi, spi_speed_hz));
+	}
+
+	_lock_gen_map(dev);
+
+	// Read config
+	TRY(_sync_config(dev));
 
 	// Check device version
-	TRY(spi_read_reg(dev->fd, RegVersion, &val));
-	if ((val & SX1231_VERSION_MASK) != SX1231_VERSION) {
+	if ((dev->shadow[RegVersion] & SX1231_VERSION_MASK) != SX1231_VERSION) {
 		err = ERR_RFM_CHIP_VERSION;
 		goto fail;
 	}
 
-	// Read config
-	TRY(_sync_config(dev));
+	if (spi_speed_hz == RF_SPI_SPEED_AUTO) {
+		TRY(_auto_spi_speed(dev, spi_path));
+	}
 
 	return ERR_OK;
 fail:
@@ -90,8 +349,39 @@ fail:
 
 void rf_close(rf_dev_t *dev)
 {
-	close(dev->fd);
-	dev->fd = -1;
+	if (dev->async != NULL) {
+		rf_async_stop(dev);
+	}
+	if (dev->stream.active) {
+		_stream_abort(dev);
+	}
+	if (dev->tx_sm.state != TX_STATE_IDLE) {
+		_tx_sm_abort(dev);
+	}
+	rf_flush(dev);
+	if (dev->tx_sm.fd >= 0) {
+		close(dev->tx_sm.fd);
+		dev->tx_sm.fd = -1;
+	}
+
+	for (int i = 0; i < RF_DIO_CNT; i++) {
+		gpio_close(&dev->dio[i]);
+	}
+	spi_close(&dev->spi);
+	if (dev->lock_gen_shared != NULL) {
+		munmap(dev->lock_gen_shared, sizeof(*dev->lock_gen_shared));
+		dev->lock_gen_shared = NULL;
+	}
+
+	pthread_cond_destroy(&dev->lock_cond);
+	pthread_mutex_destroy(&dev->lock);
+}
+
+int rf_probe_spi_speed(rf_dev_t *dev, uint32_t *speed_hz)
+{
+	return _probe_spi_speed(dev, _spi_probe_speeds,
+			sizeof(_spi_probe_speeds) / sizeof(_spi_probe_speeds[0]),
+			speed_hz);
 }
 
 int rf_config(rf_dev_t *dev,
@@ -99,179 +389,3466 @@ int rf_config(rf_dev_t *dev,
 		int modulation, double data_rate_kbps)
 {
 	int err = ERR_UNSPEC;
+	unsigned long xfer_cnt = dev->spi.xfer_cnt;
+	rf_profile_t prof;
+	spi_txn_t txn;
+
+	err = rf_profile_compile(&prof, freq_mhz, fdev_khz, modulation,
+				data_rate_kbps);
+	if (err != ERR_OK) {
+		return err;
+	}
+
+	err = _lock(dev);
+	if (err != ERR_OK) {
+		return err;
+	}
+
+	TRY(rf_flush(dev));
+
+	// Leave a module alone that is idle and already configured, eg. by a
+	// previous run of a one-shot tool
+	if (_profile_is_applied(dev, &prof) &&
+			_shadow_is(dev, RegAutoModes,
+				dev->auto_modes ? AUTO_MODES_TX : 0x00) &&
+			_shadow_is(dev, RegOpMode, _idle_mode(dev))) {
+		DBG_PRINTF(DBG_LVL_MID, "rf_config: already configured, %lu "
+				"SPI transfers\n", dev->spi.xfer_cnt - xfer_cnt);
+		_unlock(dev);
+		return ERR_OK;
+	}
 
 	// reset
 	TRY(_reset(dev));
 
-	// Program frequency configuration
-	// TODO: range validation...
-	uint32_t reg_freq = ((freq_mhz * 1e6) / SX1231_FSTEP);
-	uint16_t reg_fdev = ((fdev_khz * 1e3) / SX1231_FSTEP);
-	uint16_t reg_bitrate = SX1231_FXOSC / (data_rate_kbps * 1000);
-	uint8_t buf[7];
+	spi_txn_init(&txn);
+	_txn_apply_profile(dev, &txn, &prof);
+	_txn_write_shadow_reg(dev, &txn, RegAutoModes,
+				dev->auto_modes ? AUTO_MODES_TX : 0x00);
 
-	buf[0] = reg_bitrate >> 8;
-	buf[1] = reg_bitrate;
-	buf[2] = (reg_fdev >> 8) & 0x3f;
-	buf[3] = reg_fdev;
-	buf[4] = reg_freq >> 16;
-	buf[5] = reg_freq >> 8;
-	buf[6] = reg_freq;
-	TRY(spi_write_regs(dev->fd, RegBitrateMsb, buf, 2 + 2 + 3));
-
-	// Set modulation
-	if (modulation == SX1231_MODULATION_OOK) {
-		TRY(spi_write_reg(dev->fd, RegDataModul, 0x08));
-	} else {
-		TRY(spi_write_reg(dev->fd, RegDataModul, 0x00));
+	// Switch to idle mode, unless already configured
+	if (txn.msg_cnt != 0 || !_shadow_is(dev, RegOpMode, _idle_mode(dev))) {
+		TRY(_switch_mode_txn(dev, &txn, _idle_mode(dev)));
 	}
 
-	// Disable CLKOUT
-	TRY(spi_write_reg(dev->fd, RegDioMapping2, 0x07));
+	_set_fifo_thresh(dev, dev->shadow[RegFifoThresh] & 0x7f);
 
-	// Disable Preamble
-	TRY(spi_write_reg(dev->fd, RegPreambleMsb, 0x00));
-	TRY(spi_write_reg(dev->fd, RegPreambleLsb, 0x00));
+	DBG_PRINTF(DBG_LVL_MID, "rf_config: %lu SPI transfers\n",
+			dev->spi.xfer_cnt - xfer_cnt);
 
-	// Disable sync word
-	TRY(spi_write_reg(dev->fd, RegSyncConfig, 0x18));
+	_unlock(dev);
+	return ERR_OK;
+fail:
+	_unlock(dev);
+	return err;
+}
 
-	// Set to unlimited packet mode
-	// crcOn=false, dcFree=none, AddrFilt=none
-	TRY(spi_write_reg(dev->fd, RegPacketConfig1, 0x00));
-	TRY(spi_write_reg(dev->fd, RegPayloadLength, 0x00));
+int rf_profile_compile(rf_profile_t *prof,
+		float freq_mhz, float fdev_khz,
+		int modulation, double data_rate_kbps)
+{
+	int err = ERR_UNSPEC;
+
+	_profile_init(prof);
 
-	// Start TX if FifoNotEmpty
-	TRY(spi_write_reg(dev->fd, RegFifoThresh, 0x8f));
+	// Program frequency configuration
+	TRY(_profile_set_modulation(prof, modulation));
+	TRY(_profile_set_bitrate(prof, data_rate_kbps));
+	TRY(_profile_set_fdev(prof, fdev_khz));
+	TRY(_profile_set_frequency(prof, freq_mhz));
 
 	// Configure PA
 #ifdef WITH_PA1_DEFAULT
-	TRY(rf_set_pa(dev, 0x1f, true));
+	TRY(_profile_set_pa(prof, 0x1f, true));
 #else
-	TRY(rf_set_pa(dev, 0x1f, false));
+	TRY(_profile_set_pa(prof, 0x1f, false));
 #endif
 
+	// DIO0=PacketSent, DIO1=FifoLevel, DIO5=ModeReady, disable CLKOUT
+	_profile_set_reg(prof, RegDioMapping1, 0x00);
+	_profile_set_reg(prof, RegDioMapping2, 0x37);
+
+	// Disable preamble, sync word and Manchester encoding
+	TRY(_profile_set_framing(prof, NULL));
+
+	// Set to unlimited packet mode
+	// crcOn=false, AddrFilt=none
+	_profile_set_reg(prof, RegPayloadLength, 0x00);
+
+	// FIFO threshold is set per device when applied, see
+	// _txn_apply_profile()
+
 	// TODO: generic: modulation shaping
 	// TODO: transmitter: paRamp, over-current(OCP)
 	// TODO: test: TcxoInputOn
 
+	return ERR_OK;
+fail:
+	return err;
+}
+
+int rf_profile_set_pa(rf_profile_t *prof, uint8_t level, bool pa1_on)
+{
+	return _profile_set_pa(prof, level, pa1_on);
+}
+
+int rf_profile_set_framing(rf_profile_t *prof, const rf_framing_t *framing)
+{
+	return _profile_set_framing(prof, framing);
+}
+
+int rf_apply_profile(rf_dev_t *dev, const rf_profile_t *prof)
+{
+	int err;
+	unsigned long xfer_cnt = dev->spi.xfer_cnt;
+	spi_txn_t txn;
+
+	err = _lock(dev);
+	if (err != ERR_OK) {
+		return err;
+	}
+
+	TRY(rf_flush(dev));
+
+	spi_txn_init(&txn);
+	_txn_apply_profile(dev, &txn, prof);
+	if (txn.msg_cnt != 0) {
+		TRY(_shadow_submit(dev, &txn));
 
-	// Switch to standby mode
-	TRY(_switch_mode(dev, OP_MODE_MODE_STDBY));
+		_set_fifo_thresh(dev, dev->shadow[RegFifoThresh] & 0x7f);
+
+		DBG_PRINTF(DBG_LVL_MID, "rf_apply_profile: %lu SPI "
+				"transfers\n", dev->spi.xfer_cnt - xfer_cnt);
+	}
 
-	err = ERR_OK;
 fail:
+	_unlock(dev);
 	return err;
 }
 
 int rf_set_pa(rf_dev_t *dev, uint8_t level, bool pa1_on)
 {
-	uint8_t val = 0;
-	if (pa1_on) {
-		val |= 0x40;
-		if (level > 0x1f) {
-			val |= 0x20;
-			level -= 4;
-		}
-	} else {
-		val |= 0x80;
+	int err;
+	rf_profile_t prof;
+
+	_profile_init(&prof);
+	TRY(_profile_set_pa(&prof, level, pa1_on));
+	TRY(rf_apply_profile(dev, &prof));
+
+fail:
+	return err;
+}
+
+int rf_set_frequency(rf_dev_t *dev, double freq_mhz)
+{
+	int err;
+	rf_profile_t prof;
+
+	_profile_init(&prof);
+	TRY(_profile_set_frequency(&prof, freq_mhz));
+	TRY(rf_apply_profile(dev, &prof));
+
+fail:
+	return err;
+}
+
+int rf_set_bitrate(rf_dev_t *dev, double data_rate_kbps)
+{
+	int err;
+	rf_profile_t prof;
+
+	_profile_init(&prof);
+	TRY(_profile_set_bitrate(&prof, data_rate_kbps));
+	TRY(rf_apply_profile(dev, &prof));
+
+fail:
+	return err;
+}
+
+int rf_set_modulation(rf_dev_t *dev, int modulation)
+{
+	int err;
+	rf_profile_t prof;
+
+	_profile_init(&prof);
+	TRY(_profile_set_modulation(&prof, modulation));
+	TRY(rf_apply_profile(dev, &prof));
+
+fail:
+	return err;
+}
+
+int rf_set_fdev(rf_dev_t *dev, double fdev_khz)
+{
+	int err;
+	rf_profile_t prof;
+
+	_profile_init(&prof);
+	TRY(_profile_set_fdev(&prof, fdev_khz));
+	TRY(rf_apply_profile(dev, &prof));
+
+fail:
+	return err;
+}
+
+int rf_set_framing(rf_dev_t *dev, const rf_framing_t *framing)
+{
+	int err;
+	rf_profile_t prof;
+
+	_profile_init(&prof);
+	TRY(_profile_set_framing(&prof, framing));
+	TRY(rf_apply_profile(dev, &prof));
+
+fail:
+	return err;
+}
+
+int rf_set_refill_mode(rf_dev_t *dev, int mode)
+{
+	if (mode != RF_REFILL_POLL && mode != RF_REFILL_PREDICT) {
+		return ERR_INVAL;
 	}
 
-	if (level > 0x1f) {
+	dev->refill_mode = mode;
+
+	return ERR_OK;
+}
+
+int rf_set_wait_strategy(rf_dev_t *dev, int strategy)
+{
+	if (strategy < 0 || strategy >= RF_WAIT_STRATEGY_CNT) {
 		return ERR_INVAL;
 	}
 
-	val |= level;
+	dev->wait_strategy = strategy;
 
-	return spi_write_reg(dev->fd, RegPaLevel, val);
+	return ERR_OK;
 }
 
-int rf_send(rf_dev_t *dev, const uint8_t *data, size_t len)
+int rf_get_wait_stats(rf_dev_t *dev, int strategy, rf_wait_stats_t *stats)
 {
-	int err = ERR_UNSPEC;
-	uint8_t send_len;
-	uint8_t val;
+	if (strategy < 0 || strategy >= RF_WAIT_STRATEGY_CNT) {
+		return ERR_INVAL;
+	}
 
-	// Prefill Fifo
-	send_len = (len <= SX1231_FIFO_SIZE) ? len : SX1231_FIFO_SIZE;
-	TRY(spi_write_regs(dev->fd, RegFifo, data, send_len));
-	data += send_len;
-	len -= send_len;
+	pthread_mutex_lock(&dev->lock);
+	*stats = dev->wait_stats[strategy];
+	pthread_mutex_unlock(&dev->lock);
 
-	// Start TX
-	TRY(_switch_mode(dev, OP_MODE_MODE_TX));
+	return ERR_OK;
+}
 
-	while (len != 0) {
-		// Wait till space in FIFO
-		do {
-			TRY(spi_read_reg(dev->fd, RegIrqFlags2, &val));
-		} while (val & IRQ_FLAGS2_FIFOLEVEL);
+int rf_flush(rf_dev_t *dev)
+{
+	int err = ERR_UNSPEC;
+	bool was_pending;
 
-		// Refill Fifo
-		send_len = (len <= SX1231_FIFO_SIZE - dev->fifo_thresh) ? len : (SX1231_FIFO_SIZE - dev->fifo_thresh);
-		TRY(spi_write_regs(dev->fd, RegFifo, data, send_len));
-		data += send_len;
-		len -= send_len;
+	err = _lock(dev);
+	if (err != ERR_OK) {
+		return err;
 	}
+	was_pending = dev->tx_pending;
 
-	// Wait till done
-	do {
-		TRY(spi_read_reg(dev->fd, RegIrqFlags2, &val));
-	} while (! (val & IRQ_FLAGS2_PACKETSENT));
+	TRY(_flush(dev));
 
-	TRY(_switch_mode(dev, OP_MODE_MODE_STDBY));
+	// Module returned to standby instead of sleep mode
+	if (was_pending && _idle_mode(dev) == OP_MODE_MODE_SLEEP) {
+		TRY(_switch_mode(dev, OP_MODE_MODE_SLEEP));
+	}
 
+	_unlock(dev);
 	return ERR_OK;
 fail:
+	_recover(dev, err);
+	_unlock(dev);
 	return err;
 }
 
-static int _reset(rf_dev_t *dev)
+int rf_set_idle_policy(rf_dev_t *dev, int policy)
 {
-	/* TODO:
 	int err = ERR_UNSPEC;
-	uint8_t val;
-	*/
 
+	if (policy < 0 || policy >= RF_IDLE_POLICY_CNT) {
+		return ERR_INVAL;
+	}
+
+	err = _lock(dev);
+	if (err != ERR_OK) {
+		return err;
+	}
+
+	TRY(_flush(dev));
+
+	dev->idle_policy = policy;
+	if (!_shadow_is(dev, RegOpMode, _idle_mode(dev))) {
+		TRY(_switch_mode(dev, _idle_mode(dev)));
+	}
+
+	_unlock(dev);
 	return ERR_OK;
+fail:
+	_unlock(dev);
+	return err;
 }
 
-static int _sync_config(rf_dev_t *dev)
+int rf_get_tx_start_latency(rf_dev_t *dev, int policy, rf_latency_t *stats)
+{
+	if (policy < 0 || policy >= RF_IDLE_POLICY_CNT) {
+		return ERR_INVAL;
+	}
+
+	pthread_mutex_lock(&dev->lock);
+	*stats = dev->tx_start_latency[policy];
+	pthread_mutex_unlock(&dev->lock);
+
+	return ERR_OK;
+}
+
+double rf_latency_stddev(const rf_latency_t *stats)
+{
+	return (stats->count > 1) ? sqrt(stats->m2 / (stats->count - 1)) : 0;
+}
+
+int rf_set_auto_modes(rf_dev_t *dev, bool enable)
 {
 	int err = ERR_UNSPEC;
+	spi_txn_t txn;
+
+	err = _lock(dev);
+	if (err != ERR_OK) {
+		return err;
+	}
+
+	TRY(rf_flush(dev));
 
-	TRY(spi_read_reg(dev->fd, RegFifoThresh, &dev->fifo_thresh));
-	dev->fifo_thresh &= 0x7f;
+	spi_txn_init(&txn);
+	_txn_write_shadow_reg(dev, &txn, RegAutoModes,
+				enable ? AUTO_MODES_TX : 0x00);
+	if (txn.msg_cnt != 0) {
+		TRY(_shadow_submit(dev, &txn));
+	}
+	dev->auto_modes = enable;
 
+	_unlock(dev);
 	return ERR_OK;
 fail:
+	_unlock(dev);
 	return err;
 }
 
-static int _switch_mode(rf_dev_t *dev, int mode)
+int rf_set_underrun_target(rf_dev_t *dev, double prob)
+{
+	int err;
+
+	if (prob < 0 || prob >= 1) {
+		return ERR_INVAL;
+	}
+
+	err = _lock(dev);
+	if (err != ERR_OK) {
+		return err;
+	}
+
+	dev->underrun_prob = prob;
+	err = _tune_fifo_thresh(dev);
+
+	_unlock(dev);
+	return err;
+}
+
+void rf_get_fifo_tuning(rf_dev_t *dev, rf_fifo_tuning_t *tuning)
+{
+	rf_latency_t lat;
+
+	pthread_mutex_lock(&dev->lock);
+	tuning->thresh = dev->fifo_thresh;
+	lat = dev->refill_latency;
+	pthread_mutex_unlock(&dev->lock);
+
+	tuning->chunk = SX1231_FIFO_SIZE - tuning->thresh;
+	tuning->samples = lat.count;
+	tuning->latency_mean = lat.mean;
+	tuning->latency_stddev = rf_latency_stddev(&lat);
+	tuning->latency_max = lat.max;
+}
+
+void rf_get_stats(rf_dev_t *dev, rf_stats_t *stats)
+{
+	const rf_stats_counters_t *cnt = &dev->stats;
+	int i;
+
+	stats->xfers = dev->spi.xfer_cnt;
+	stats->spi_bytes = dev->spi.xfer_bytes;
+	stats->polls = cnt->polls;
+	stats->refills = cnt->refills;
+	stats->min_headroom = cnt->min_headroom;
+	stats->underruns = cnt->underruns;
+	stats->sends = cnt->sends;
+	stats->airtime = cnt->airtime;
+	stats->mode_switch_time = cnt->mode_switch_time;
+	for (i = 0; i < RF_HIST_BUCKETS; i++) {
+		stats->send_time.count[i] = cnt->send_time[i];
+		stats->mode_switch.count[i] = cnt->mode_switch[i];
+	}
+}
+
+int rf_trace_open(rf_dev_t *dev, const char *path, size_t records)
+{
+#ifdef WITH_TRACE
+	int err;
+
+	err = _lock(dev);
+	if (err != ERR_OK) {
+		return err;
+	}
+
+	err = trace_open(&dev->spi.trace, path,
+			(records != 0) ? records : TRACE_DEFAULT_RECORDS);
+
+	_unlock(dev);
+	return err;
+#else
+	(void) dev;
+	(void) path;
+	(void) records;
+
+	return ERR_NOT_SUPPORTED;
+#endif
+}
+
+int rf_attach_dio(rf_dev_t *dev, int dio, const char *chip_path,
+			unsigned int offset)
+{
+	if (dio != RF_DIO_PACKETSENT && dio != RF_DIO_FIFOLEVEL &&
+			dio != RF_DIO_MODEREADY) {
+		return ERR_INVAL;
+	}
+
+	gpio_close(&dev->dio[dio]);
+
+	if (strcmp(chip_path, SPI_SIM_PATH_PREFIX) == 0) {
+		return spi_sim_open_dio(&dev->spi, &dev->dio[dio], dio);
+	}
+
+	return gpio_open_input(&dev->dio[dio], chip_path, offset);
+}
+
+int rf_send(rf_dev_t *dev, const uint8_t *data, size_t len)
+{
+	struct iovec iov = { (void *) data, len };
+
+	return rf_sendv(dev, &iov, 1);
+}
+
+int rf_sendv(rf_dev_t *dev, const struct iovec *iov, int iovcnt)
 {
 	int err = ERR_UNSPEC;
-	uint8_t val;
+	unsigned long xfer_cnt = dev->spi.xfer_cnt;
+	iov_source_t src;
 
-	assert((mode & ~0x1c) == 0);
+	if (iovcnt < 0) {
+		return ERR_INVAL;
+	}
 
-	TRY(spi_write_reg(dev->fd, RegOpMode, mode));
+	_iov_source_init(&src, iov, iovcnt);
+	TRY(_send(dev, &src.src, 0));
 
-	do {
-		// TODO: add timeout
-		TRY(spi_read_reg(dev->fd, RegIrqFlags1, &val));
-	} while (! (val & IRQ_FLAGS1_MODEREADY));
+	DBG_PRINTF(DBG_LVL_MID, "rf_sendv: %lu SPI transfers\n",
+			dev->spi.xfer_cnt - xfer_cnt);
 
 	return ERR_OK;
 fail:
 	return err;
 }
 
+int rf_send_bits(rf_dev_t *dev, const uint8_t *data, size_t bits)
+{
+	uint8_t tail;
+	struct iovec iov[2] = {
+		{ (void *) data, bits / 8 },
+		{ &tail, 0 }
+	};
+
+	if (bits % 8 != 0) {
+		// Pad partial last byte with zeros
+		tail = data[bits / 8] & (0xff << (8 - bits % 8));
+		iov[1].iov_len = 1;
+	}
+
+	return rf_sendv(dev, iov, 2);
+}
+
+int rf_send_at(rf_dev_t *dev, const uint8_t *data, size_t len,
+		uint64_t deadline)
+{
+	int err = ERR_UNSPEC;
+	struct iovec iov = { (void *) data, len };
+	iov_source_t src;
+
+	if (deadline == 0) {
+		return ERR_INVAL;
+	}
+
+	_iov_source_init(&src, &iov, 1);
+	TRY(_send(dev, &src.src, deadline));
+
+	DBG_PRINTF(DBG_LVL_MID, "rf_send_at: start error %" PRId64 " ns\n",
+			dev->start_error);
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+void rf_get_start_error(rf_dev_t *dev, int64_t *last, rf_latency_t *stats)
+{
+	pthread_mutex_lock(&dev->lock);
+	if (last != NULL) {
+		*last = dev->start_error;
+	}
+	if (stats != NULL) {
+		*stats = dev->start_error_abs;
+	}
+	pthread_mutex_unlock(&dev->lock);
+}
+
+void rf_get_lock_wait(rf_dev_t *dev, uint64_t *last, rf_latency_t *stats)
+{
+	pthread_mutex_lock(&dev->lock);
+	if (last != NULL) {
+		*last = dev->lock_wait;
+	}
+	if (stats != NULL) {
+		*stats = dev->lock_wait_stats;
+	}
+	pthread_mutex_unlock(&dev->lock);
+}
+
+int rf_send_train(rf_dev_t *dev, const rf_train_entry_t *entries, size_t cnt)
+{
+	int err = ERR_UNSPEC;
+	unsigned long xfer_cnt = dev->spi.xfer_cnt;
+	train_source_t src;
+	size_t len;
+
+	if (_framing_enabled(dev)) {
+		// Gaps can't be part of a framed transmission
+		return _send_train_framed(dev, entries, cnt);
+	}
+
+	_train_source_init(&src, entries, cnt, dev->byte_time);
+	len = src.src.remaining;
+	TRY(_send(dev, &src.src, 0));
+
+	DBG_PRINTF(DBG_LVL_MID, "rf_send_train: %zu bytes, %lu SPI transfers\n",
+			len, dev->spi.xfer_cnt - xfer_cnt);
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+int rf_stream_begin(rf_dev_t *dev)
+{
+	int err = ERR_UNSPEC;
+	rf_stream_t *stream = &dev->stream;
+
+	// Held till the stream ends
+	err = _lock(dev);
+	if (err != ERR_OK) {
+		return err;
+	}
+
+	if (stream->active) {
+		err = ERR_INVAL;
+		goto fail;
+	}
+
+	TRY(_tx_prepare(dev, 0, &stream->start, &stream->idle));
+
+	stream->active = true;
+	stream->tx = false;
+	stream->rd = 0;
+	stream->cnt = 0;
+	stream->len = 0;
+	TRACE(&dev->spi.trace, TRACE_SEND_START, 0, 0, NULL, 0);
+
+	return ERR_OK;
+fail:
+	_unlock(dev);
+	return err;
+}
+
+int rf_stream_write(rf_dev_t *dev, const uint8_t *data, size_t len)
+{
+	int err = ERR_UNSPEC;
+	rf_stream_t *stream = &dev->stream;
+	size_t wr;
+	size_t n;
+
+	if (!stream->active) {
+		return ERR_INVAL;
+	}
+
+	stream->len += len;
+	while (len != 0) {
+		// Copy as much as fits in the buffer
+		while (len != 0 && stream->cnt < RF_STREAM_BUF_SIZE) {
+			wr = (stream->rd + stream->cnt) % RF_STREAM_BUF_SIZE;
+			n = RF_STREAM_BUF_SIZE - stream->cnt;
+			if (n > RF_STREAM_BUF_SIZE - wr) {
+				n = RF_STREAM_BUF_SIZE - wr;
+			}
+			if (n > len) {
+				n = len;
+			}
+			memcpy(&stream->buf[wr], data, n);
+			stream->cnt += n;
+			data += n;
+			len -= n;
+		}
+
+		if (!stream->tx) {
+			if (stream->cnt >= SX1231_FIFO_SIZE) {
+				TRY(_stream_start(dev));
+			}
+			continue;
+		}
+
+		// Only block on the module when the buffer is full
+		TRY(_stream_refill(dev, len != 0));
+	}
+
+	return ERR_OK;
+fail:
+	_recover(dev, err);
+	_stream_abort(dev);
+	return err;
+}
+
+int rf_stream_end(rf_dev_t *dev)
+{
+	int err = ERR_UNSPEC;
+	rf_stream_t *stream = &dev->stream;
+	uint64_t expect;
+
+	if (!stream->active) {
+		return ERR_INVAL;
+	}
+
+	if (!stream->tx) {
+		if (stream->cnt == 0) {
+			// Nothing to send
+			stream->active = false;
+			_unlock(dev);
+			return ERR_OK;
+		}
+		TRY(_stream_start(dev));
+	}
+
+	while (stream->cnt != 0) {
+		TRY(_stream_refill(dev, true));
+	}
+
+	// Wait till done
+	if (dev->refill_mode == RF_REFILL_PREDICT) {
+		// See _send_predicted(), the last byte is still in the shift
+		// register when the FIFO runs empty
+		expect = stream->tx_start + stream->written * dev->byte_time +
+				dev->byte_time;
+		if (!dev->auto_modes) {
+			_wait_until(dev, expect);
+		}
+	} else {
+		expect = stream->expect + dev->fifo_thresh * dev->byte_time;
+	}
+	if (dev->auto_modes) {
+		dev->tx_end = expect;
+	} else {
+		TRY(_wait_flag(dev, RegIrqFlags2, IRQ_FLAGS2_PACKETSENT, true,
+				expect, _wait_deadline(dev, expect,
+							SX1231_FIFO_SIZE)));
+	}
+	TRY(_tx_finish(dev, stream->idle));
+	_stats_send(dev, stream->start, stream->len);
+	TRACE(&dev->spi.trace, TRACE_SEND_DONE, 0, ERR_OK, NULL, stream->len);
+
+	stream->active = false;
+	_unlock(dev);
+
+	return ERR_OK;
+fail:
+	TRACE(&dev->spi.trace, TRACE_SEND_DONE, 0, err, NULL, stream->len);
+	_recover(dev, err);
+	_stream_abort(dev);
+	return err;
+}
+
+int rf_stream_abort(rf_dev_t *dev)
+{
+	int err = ERR_UNSPEC;
+	rf_stream_t *stream = &dev->stream;
+	spi_txn_t txn;
+
+	if (!stream->active) {
+		return ERR_INVAL;
+	}
+
+	stream->active = false;
+	stream->cnt = 0;
+	TRACE(&dev->spi.trace, TRACE_SEND_DONE, 0, ERR_INVAL, NULL, stream->len);
+
+	if (stream->tx) {
+		// Stop transmitter and clear the FIFO
+		TRY(_reset(dev));
+
+		spi_txn_init(&txn);
+		_txn_write_shadow_reg(dev, &txn, RegAutoModes,
+					dev->auto_modes ? AUTO_MODES_TX : 0x00);
+		if (!_shadow_is(dev, RegOpMode, stream->idle)) {
+			TRY(_switch_mode_txn(dev, &txn, stream->idle));
+		} else if (txn.msg_cnt != 0) {
+			TRY(_shadow_submit(dev, &txn));
+		}
+	}
+
+	_unlock(dev);
+	return ERR_OK;
+fail:
+	_unlock(dev);
+	return err;
+}
+
+int rf_tx_begin(rf_dev_t *dev, const uint8_t *data, size_t len)
+{
+	int err = ERR_UNSPEC;
+	rf_tx_sm_t *sm = &dev->tx_sm;
+
+	if (rf_tx_fd(dev) < 0) {
+		return ERR_TIMER;
+	}
+
+	// Held till the transmission is done
+	err = _lock(dev);
+	if (err != ERR_OK) {
+		return err;
+	}
+
+	if (sm->state != TX_STATE_IDLE || dev->stream.active) {
+		_unlock(dev);
+		return ERR_INVAL;
+	}
+
+	sm->start = time_now_ns();
+	_update_send_interval(dev, sm->start);
+	sm->idle = _idle_mode(dev);
+	sm->data = data;
+	sm->len = len;
+	sm->waking = false;
+
+	if (dev->tx_pending) {
+		sm->state = TX_STATE_FLUSH;
+		sm->due = dev->tx_end;
+		sm->deadline = _wait_deadline(dev, dev->tx_end,
+						SX1231_FIFO_SIZE);
+	} else {
+		sm->state = TX_STATE_START;
+		sm->due = sm->start;
+	}
+
+	// Start right away if possible
+	TRY(_tx_sm_step(dev, sm->start));
+	if (sm->state == TX_STATE_IDLE) {
+		_stats_send(dev, sm->start, sm->written);
+		_unlock(dev);
+	}
+	TRY(_tx_sm_arm(dev));
+
+	return ERR_OK;
+fail:
+	_recover(dev, err);
+	_tx_sm_abort(dev);
+	return err;
+}
+
+int rf_tx_step(rf_dev_t *dev, bool *done)
+{
+	int err = ERR_UNSPEC;
+	rf_tx_sm_t *sm = &dev->tx_sm;
+	uint64_t expirations;
+	uint64_t now;
+
+	if (sm->fd < 0) {
+		return ERR_INVAL;
+	}
+
+	// Clear readable state of timer
+	if (read(sm->fd, &expirations, sizeof(expirations)) < 0 &&
+			errno != EAGAIN) {
+		err = ERR_TIMER;
+		goto fail;
+	}
+
+	now = time_now_ns();
+	if (sm->state != TX_STATE_IDLE && now >= sm->due) {
+		TRY(_tx_sm_step(dev, now));
+		if (sm->state == TX_STATE_IDLE) {
+			_stats_send(dev, sm->start, sm->written);
+			_unlock(dev);
+		}
+	}
+	TRY(_tx_sm_arm(dev));
+
+	*done = (sm->state == TX_STATE_IDLE);
+
+	return ERR_OK;
+fail:
+	_recover(dev, err);
+	_tx_sm_abort(dev);
+	*done = true;
+	return err;
+}
+
+int rf_tx_fd(rf_dev_t *dev)
+{
+	if (dev->tx_sm.fd < 0) {
+		dev->tx_sm.fd = timerfd_create(CLOCK_MONOTONIC,
+				TFD_NONBLOCK | TFD_CLOEXEC);
+	}
+
+	return dev->tx_sm.fd;
+}
+
+/**
+ * Prepare module for a transmission
+ *
+ * @param dev		Device handle
+ * @param deadline	Time to start transmitting at, or 0 to start as soon
+ *			as possible
+ * @param start		Returns time the transmission was requested
+ * @param idle		Returns mode to return to after the transmission
+ */
+static int _tx_prepare(rf_dev_t *dev, uint64_t deadline, uint64_t *start,
+				int *idle)
+{
+	int err = ERR_UNSPEC;
+
+	TRY(_flush(dev));
+
+	TRY(_tune_fifo_thresh(dev));
+
+	*start = time_now_ns();
+	_update_send_interval(dev, (deadline != 0) ? deadline : *start);
+	*idle = _idle_mode(dev);
+
+	if (deadline != 0) {
+		// Park synthesizer, only the transmitter has to start on trigger
+		if (!_shadow_is(dev, RegOpMode, OP_MODE_MODE_FS)) {
+			TRY(_switch_mode(dev, OP_MODE_MODE_FS));
+		}
+	} else {
+		// FIFO can't be used in sleep mode
+		if (_shadow_is(dev, RegOpMode, OP_MODE_MODE_SLEEP)) {
+			TRY(_switch_mode(dev, OP_MODE_MODE_STDBY));
+		}
+
+		// With automatic modes the module returns to the mode in
+		// RegOpMode
+		if (dev->auto_modes && *idle != OP_MODE_MODE_SLEEP &&
+				!_shadow_is(dev, RegOpMode, *idle)) {
+			TRY(_switch_mode(dev, *idle));
+		}
+	}
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+/**
+ * Start transmitter after executing transaction filling the FIFO
+ *
+ * @param dev		Device handle
+ * @param txn		Transaction filling the FIFO
+ * @param start		Time the transmission was requested
+ * @param tx_start	Returns time transmission started
+ */
+static int _tx_start(rf_dev_t *dev, spi_txn_t *txn, uint64_t start,
+				uint64_t *tx_start)
+{
+	int err = ERR_UNSPEC;
+
+	if (dev->auto_modes) {
+		// Module enters TX on the first FIFO byte by itself
+		TRY(spi_txn_submit(&dev->spi, txn));
+		*tx_start = time_now_ns() + _tx_startup_time(dev);
+	} else {
+		TRY(_switch_mode_txn(dev, txn, OP_MODE_MODE_TX));
+		*tx_start = time_now_ns();
+	}
+	_latency_add_shared(dev, &dev->tx_start_latency[dev->idle_policy],
+			*tx_start - start);
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+/**
+ * Return to idle mode after all data is sent
+ */
+static int _tx_finish(rf_dev_t *dev, int idle)
+{
+	if (dev->auto_modes) {
+		// Module returns to idle mode after PacketSent by itself
+		dev->tx_pending = true;
+		return ERR_OK;
+	}
+
+	return _switch_mode(dev, idle);
+}
+
+/**
+ * Transmit data from source in a single TX session
+ *
+ * @param dev		Device handle
+ * @param src		Data to send
+ * @param deadline	Time to start transmitting at, or 0 to start as soon
+ *			as possible
+ */
+static int _send(rf_dev_t *dev, tx_source_t *src, uint64_t deadline)
+{
+	int err = ERR_UNSPEC;
+	uint8_t buf[SX1231_FIFO_SIZE];
+	size_t send_len;
+	uint64_t start;
+	uint64_t tx_start;
+	uint64_t startup;
+	uint64_t trigger;
+	uint64_t lead;
+	uint8_t irq_flags = IRQ_FLAGS1_MODEREADY;
+	uint64_t call_start = time_now_ns();
+	size_t len = src->remaining;
+	int idle;
+	spi_txn_t txn;
+
+	RF_PROBE3(send__start, len, call_start, deadline);
+	TRACE(&dev->spi.trace, TRACE_SEND_START, 0, 0, NULL, len);
+
+	err = _lock(dev);
+	if (err != ERR_OK) {
+		RF_PROBE2(send__done, len, err);
+		TRACE(&dev->spi.trace, TRACE_SEND_DONE, 0, err, NULL, len);
+		return err;
+	}
+
+	TRY(_tx_prepare(dev, deadline, &start, &idle));
+
+	// Prefill Fifo
+	spi_txn_init(&txn);
+	send_len = (src->remaining <= SX1231_FIFO_SIZE) ?
+			src->remaining : SX1231_FIFO_SIZE;
+	_source_read(src, buf, send_len);
+	spi_txn_write(&txn, RegFifo, buf, send_len);
+
+	if (deadline == 0) {
+		TRY(_tx_start(dev, &txn, start, &tx_start));
+	} else {
+		if (!dev->auto_modes) {
+			// Preload FIFO, leaving only the mode switch as trigger.
+			// With automatic modes the FIFO write is the trigger.
+			TRY(spi_txn_submit(&dev->spi, &txn));
+			spi_txn_init(&txn);
+			spi_txn_write_reg(&txn, RegOpMode, OP_MODE_MODE_TX);
+			spi_txn_read(&txn, RegIrqFlags1, &irq_flags, 1);
+			dev->shadow[RegOpMode] = OP_MODE_MODE_TX;
+		}
+
+		// Trigger early by the startup time and the trigger transfer
+		startup = _tx_startup_time(dev);
+		lead = startup + (uint64_t) dev->trigger_latency.mean;
+		_wait_trigger(dev, (deadline > lead) ? deadline - lead : 0);
+
+		trigger = time_now_ns();
+		TRY(_shadow_submit(dev, &txn));
+		tx_start = time_now_ns();
+		_latency_add(&dev->trigger_latency, tx_start - trigger);
+		tx_start += startup;
+
+		pthread_mutex_lock(&dev->lock);
+		dev->start_error = (int64_t) (tx_start - deadline);
+		_latency_add(&dev->start_error_abs, (dev->start_error < 0) ?
+				-dev->start_error : dev->start_error);
+		pthread_mutex_unlock(&dev->lock);
+
+		if (! (irq_flags & IRQ_FLAGS1_MODEREADY)) {
+			TRY(_wait_flag(dev, RegIrqFlags1, IRQ_FLAGS1_MODEREADY,
+					true, tx_start,
+					_wait_deadline(dev, tx_start, 0)));
+		}
+	}
+
+	dev->last_tx_start = tx_start;
+
+	// The FIFO is read after the preamble and sync word
+	tx_start += dev->header_time;
+
+	if (dev->refill_mode == RF_REFILL_PREDICT) {
+		TRY(_send_predicted(dev, src, send_len, tx_start));
+	} else {
+		TRY(_send_polled(dev, src, send_len, tx_start));
+	}
+
+	TRY(_tx_finish(dev, idle));
+	_stats_send(dev, call_start, len);
+
+	_unlock(dev);
+	RF_PROBE2(send__done, len, ERR_OK);
+	TRACE(&dev->spi.trace, TRACE_SEND_DONE, 0, ERR_OK, NULL, len);
+	return ERR_OK;
+fail:
+	_recover(dev, err);
+	_unlock(dev);
+	RF_PROBE2(send__done, len, err);
+	TRACE(&dev->spi.trace, TRACE_SEND_DONE, 0, err, NULL, len);
+	return err;
+}
+
+/**
+ * Send frame train as separate transmissions
+ *
+ * The module adds its framing to every transmission. The gaps are timed
+ * like rf_send_at(), from the calculated end of the previous frame.
+ */
+static int _send_train_framed(rf_dev_t *dev, const rf_train_entry_t *entries,
+				size_t cnt)
+{
+	int err = ERR_UNSPEC;
+	iov_source_t src;
+	uint64_t deadline = 0;
+	size_t len;
+	size_t i;
+	unsigned int j;
+
+	for (i = 0; i < cnt; i++) {
+		for (j = 0; j < entries[i].repeat; j++) {
+			_iov_source_init(&src, entries[i].iov,
+						entries[i].iovcnt);
+			len = src.src.remaining;
+			TRY(_send(dev, &src.src, deadline));
+
+			deadline = dev->last_tx_start + dev->header_time +
+					len * dev->byte_time +
+					entries[i].gap_us * NSEC_PER_USEC;
+		}
+	}
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+/**
+ * Take bytes from stream buffer
+ */
+static void _stream_pop(rf_stream_t *stream, uint8_t *buf, size_t len)
+{
+	size_t n;
+
+	assert(len <= stream->cnt);
+
+	n = RF_STREAM_BUF_SIZE - stream->rd;
+	if (n > len) {
+		n = len;
+	}
+	memcpy(buf, &stream->buf[stream->rd], n);
+	memcpy(buf + n, stream->buf, len - n);
+
+	stream->rd = (stream->rd + len) % RF_STREAM_BUF_SIZE;
+	stream->cnt -= len;
+}
+
+/**
+ * Prefill FIFO from stream buffer and start transmitter
+ */
+static int _stream_start(rf_dev_t *dev)
+{
+	int err = ERR_UNSPEC;
+	rf_stream_t *stream = &dev->stream;
+	uint8_t buf[SX1231_FIFO_SIZE];
+	size_t send_len;
+	uint64_t tx_start;
+	spi_txn_t txn;
+
+	send_len = (stream->cnt < SX1231_FIFO_SIZE) ?
+			stream->cnt : SX1231_FIFO_SIZE;
+	_stream_pop(stream, buf, send_len);
+
+	spi_txn_init(&txn);
+	spi_txn_write(&txn, RegFifo, buf, send_len);
+	TRY(_tx_start(dev, &txn, time_now_ns(), &tx_start));
+	stream->tx = true;
+	dev->last_tx_start = tx_start;
+
+	// See _send_polled(), the FIFO is read after the preamble and sync word
+	stream->expect = tx_start + dev->header_time;
+	if (send_len > dev->fifo_thresh) {
+		stream->expect += (send_len - dev->fifo_thresh) * dev->byte_time;
+	}
+
+	// FIFO model for RF_REFILL_PREDICT, see _send_predicted()
+	stream->tx_start = tx_start + dev->header_time;
+	stream->written = send_len;
+	stream->refills = 0;
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+/**
+ * Refill FIFO from stream buffer if there is space
+ *
+ * @param dev	Device handle
+ * @param block	Wait till there is space in FIFO. Else only refills if the
+ *		FIFO level dropped below the threshold.
+ *
+ * @returns	0 on success, ERR_RFM_TX_OUT_OF_SYNC if the FIFO ran empty
+ */
+static int _stream_refill(rf_dev_t *dev, bool block)
+{
+	int err = ERR_UNSPEC;
+	rf_stream_t *stream = &dev->stream;
+	uint8_t buf[SX1231_FIFO_SIZE];
+	size_t send_len;
+	uint64_t now;
+	uint8_t val;
+
+	if (stream->cnt == 0) {
+		return ERR_OK;
+	}
+
+	if (dev->refill_mode == RF_REFILL_PREDICT) {
+		return _stream_refill_predicted(dev, block);
+	}
+
+	if (block) {
+		TRY(_wait_flag(dev, RegIrqFlags2, IRQ_FLAGS2_FIFOLEVEL, false,
+				stream->expect, _wait_deadline(dev,
+					stream->expect, SX1231_FIFO_SIZE)));
+	} else {
+		// Don't poll before the FIFO is expected to have space
+		if (time_now_ns() < stream->expect) {
+			return ERR_OK;
+		}
+		TRY(spi_read_reg(&dev->spi, RegIrqFlags2, &val));
+		_stats_inc(&dev->stats.polls);
+		if ((val & IRQ_FLAGS2_FIFOLEVEL) &&
+				!(val & IRQ_FLAGS2_PACKETSENT)) {
+			return ERR_OK;
+		}
+	}
+
+	send_len = SX1231_FIFO_SIZE - dev->fifo_thresh;
+	if (stream->cnt < send_len) {
+		send_len = stream->cnt;
+	}
+	_stream_pop(stream, buf, send_len);
+
+	err = _fifo_refill(dev, buf, send_len, _refill_headroom(dev,
+				block ? dev->flag_mark : stream->expect));
+	if (err == ERR_RFM_TX_OUT_OF_SYNC) {
+		DBG_PRINTF(DBG_LVL_LOW, "Stream underrun, producer too slow\n");
+	}
+	TRY(err);
+
+	now = time_now_ns();
+	if (block) {
+		_latency_add_shared(dev, &dev->refill_latency,
+				now - dev->flag_mark);
+	}
+
+	stream->expect = now + send_len * dev->byte_time;
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+/**
+ * Refill FIFO from stream buffer at the predicted time, see _stream_refill()
+ */
+static int _stream_refill_predicted(rf_dev_t *dev, bool block)
+{
+	int err = ERR_UNSPEC;
+	rf_stream_t *stream = &dev->stream;
+	uint8_t buf[SX1231_FIFO_SIZE];
+	fifo_model_t model;
+	size_t send_len;
+	uint64_t due;
+
+	model.start = stream->tx_start;
+	model.byte_time = dev->byte_time;
+	model.written = stream->written;
+
+	// Refill when the FIFO is predicted to drop to the threshold, like
+	// with polling, so a slow producer doesn't cause many small refills
+	due = _fifo_model_time_at(&model, dev->fifo_thresh);
+	if (block) {
+		_wait_until(dev, due);
+	} else if (time_now_ns() < due) {
+		return ERR_OK;
+	}
+
+	send_len = SX1231_FIFO_SIZE - PREDICT_MARGIN - dev->fifo_thresh;
+	if (stream->cnt < send_len) {
+		send_len = stream->cnt;
+	}
+	_stream_pop(stream, buf, send_len);
+
+	stream->refills++;
+	err = _predict_refill(dev, &model, buf, send_len, due,
+				stream->refills);
+	if (err == ERR_RFM_TX_OUT_OF_SYNC) {
+		DBG_PRINTF(DBG_LVL_LOW, "Stream underrun, producer too slow\n");
+	}
+	TRY(err);
+
+	stream->tx_start = model.start;
+	stream->written = model.written;
+	stream->expect = _fifo_model_time_at(&model, dev->fifo_thresh);
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+/**
+ * End stream after an error
+ */
+static void _stream_abort(rf_dev_t *dev)
+{
+	rf_stream_t *stream = &dev->stream;
+
+	stream->active = false;
+	if (stream->tx) {
+		if (dev->auto_modes) {
+			dev->tx_pending = true;
+			dev->tx_end = stream->expect;
+		} else {
+			_switch_mode(dev, stream->idle);
+		}
+	}
+
+	_unlock(dev);
+}
+
+/**
+ * Perform due step of non-blocking transmission
+ *
+ * Like _send(), but every wait is replaced by returning with the time the
+ * next step is due.
+ */
+static int _tx_sm_step(rf_dev_t *dev, uint64_t now)
+{
+	int err = ERR_UNSPEC;
+	rf_tx_sm_t *sm = &dev->tx_sm;
+	size_t send_len;
+	uint64_t startup;
+	fifo_model_t model;
+	size_t level;
+	uint8_t val;
+	spi_txn_t txn;
+
+	switch (sm->state) {
+	case TX_STATE_FLUSH:
+		// AutoMode flag is set while in the intermediate mode
+		TRY(spi_read_reg(&dev->spi, RegIrqFlags1, &val));
+		_stats_inc(&dev->stats.polls);
+		if (val & IRQ_FLAGS1_AUTOMODE) {
+			TRY(_tx_sm_repoll(dev, now));
+			break;
+		}
+		dev->tx_pending = false;
+		sm->state = TX_STATE_START;
+		// fall through
+	case TX_STATE_START:
+		// FIFO can't be used in sleep mode
+		if (_shadow_is(dev, RegOpMode, OP_MODE_MODE_SLEEP)) {
+			spi_txn_init(&txn);
+			spi_txn_write_reg(&txn, RegOpMode, OP_MODE_MODE_STDBY);
+			dev->shadow[RegOpMode] = OP_MODE_MODE_STDBY;
+			TRY(_shadow_submit(dev, &txn));
+			sm->waking = true;
+			sm->due = now + SX1231_TS_OSC_NS;
+			sm->deadline = _wait_deadline(dev, 0, 0);
+			break;
+		}
+		if (sm->waking) {
+			TRY(spi_read_reg(&dev->spi, RegIrqFlags1, &val));
+			_stats_inc(&dev->stats.polls);
+			if (! (val & IRQ_FLAGS1_MODEREADY)) {
+				TRY(_tx_sm_repoll(dev, now));
+				break;
+			}
+			sm->waking = false;
+		}
+
+		TRY(_tune_fifo_thresh(dev));
+
+		spi_txn_init(&txn);
+
+		// With automatic modes the module returns to the mode in
+		// RegOpMode
+		if (dev->auto_modes && sm->idle != OP_MODE_MODE_SLEEP &&
+				!_shadow_is(dev, RegOpMode, sm->idle)) {
+			spi_txn_write_reg(&txn, RegOpMode, sm->idle);
+			dev->shadow[RegOpMode] = sm->idle;
+		}
+		startup = _tx_startup_time(dev);
+
+		// Prefill Fifo
+		send_len = (sm->len <= SX1231_FIFO_SIZE) ?
+				sm->len : SX1231_FIFO_SIZE;
+		spi_txn_write(&txn, RegFifo, sm->data, send_len);
+		sm->data += send_len;
+		sm->len -= send_len;
+
+		// Start TX, with automatic modes the FIFO write does this
+		if (!dev->auto_modes) {
+			spi_txn_write_reg(&txn, RegOpMode, OP_MODE_MODE_TX);
+			dev->shadow[RegOpMode] = OP_MODE_MODE_TX;
+		}
+		TRY(_shadow_submit(dev, &txn));
+
+		now = time_now_ns() + startup;
+		_latency_add_shared(dev,
+				&dev->tx_start_latency[dev->idle_policy],
+				now - sm->start);
+		dev->last_tx_start = now;
+
+		// Transmission starts no later than now, see _send_predicted().
+		// The FIFO is read after the preamble and sync word.
+		sm->tx_start = now + dev->header_time;
+		sm->written = send_len;
+		sm->state = TX_STATE_REFILL;
+		if (sm->len != 0) {
+			_tx_sm_expect_drop(dev);
+			break;
+		}
+		// fall through
+	case TX_STATE_REFILL:
+		model.start = sm->tx_start;
+		model.byte_time = dev->byte_time;
+		model.written = sm->written;
+		if (sm->len != 0) {
+			// Keep the model in sync with the FIFO level flag, so
+			// late refills don't accumulate
+			TRY(spi_read_reg(&dev->spi, RegIrqFlags2, &val));
+			_stats_inc(&dev->stats.polls);
+			level = _fifo_model_level(&model, now);
+			if (val & IRQ_FLAGS2_FIFOLEVEL) {
+				if (level <= dev->fifo_thresh) {
+					_fifo_model_correct(&model, now,
+							dev->fifo_thresh + 1);
+					sm->tx_start = model.start;
+				}
+				TRY(_tx_sm_repoll(dev, now));
+				break;
+			}
+			if (level > dev->fifo_thresh) {
+				_fifo_model_correct(&model, now,
+						dev->fifo_thresh);
+				sm->tx_start = model.start;
+			}
+
+			send_len = SX1231_FIFO_SIZE - dev->fifo_thresh;
+			if (sm->len < send_len) {
+				send_len = sm->len;
+			}
+			TRY(_fifo_refill(dev, sm->data, send_len,
+					_fifo_model_level(&model,
+							time_now_ns())));
+			sm->data += send_len;
+			sm->len -= send_len;
+			sm->written += send_len;
+			model.written = sm->written;
+
+			_latency_add_shared(dev, &dev->refill_latency,
+					time_now_ns() - dev->flag_mark);
+			if (sm->len != 0) {
+				_tx_sm_expect_drop(dev);
+				break;
+			}
+		}
+
+		// Wait till predicted done, last byte is still in the shift
+		// register
+		sm->due = _fifo_model_time_at(&model, 0) + dev->byte_time;
+		sm->deadline = _wait_deadline(dev, sm->due, SX1231_FIFO_SIZE);
+		sm->state = TX_STATE_DRAIN;
+		if (dev->auto_modes) {
+			// Module returns to idle mode after PacketSent by
+			// itself
+			dev->tx_pending = true;
+			dev->tx_end = sm->due;
+			sm->state = TX_STATE_IDLE;
+		}
+		break;
+	case TX_STATE_DRAIN:
+		TRY(spi_read_reg(&dev->spi, RegIrqFlags2, &val));
+		_stats_inc(&dev->stats.polls);
+		if (! (val & IRQ_FLAGS2_PACKETSENT)) {
+			TRY(_tx_sm_repoll(dev, now));
+			break;
+		}
+
+		// Mode is ready before the next transmission, no need to wait
+		spi_txn_init(&txn);
+		spi_txn_write_reg(&txn, RegOpMode, sm->idle);
+		dev->shadow[RegOpMode] = sm->idle;
+		TRY(_shadow_submit(dev, &txn));
+		sm->state = TX_STATE_IDLE;
+		break;
+	default:
+		break;
+	}
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+/**
+ * Schedule FIFO level check for predicted drop below threshold
+ *
+ * The check is done early by the wake-up margin, as the flag isn't polled
+ * continuously like in _wait_flag().
+ */
+static void _tx_sm_expect_drop(rf_dev_t *dev)
+{
+	rf_tx_sm_t *sm = &dev->tx_sm;
+	fifo_model_t model;
+	uint64_t margin = _wait_margin(dev);
+
+	model.start = sm->tx_start;
+	model.byte_time = dev->byte_time;
+	model.written = sm->written;
+	sm->due = _fifo_model_time_at(&model, dev->fifo_thresh);
+	if (sm->due > margin) {
+		sm->due -= margin;
+	}
+	dev->flag_mark = sm->due;
+	sm->deadline = _wait_deadline(dev, sm->due, SX1231_FIFO_SIZE);
+}
+
+/**
+ * Schedule next poll of a flag that didn't change yet
+ *
+ * @returns	0 on success, ERR_RFM_TIMEOUT if the step's deadline passed
+ */
+static int _tx_sm_repoll(rf_dev_t *dev, uint64_t now)
+{
+	if (now > dev->tx_sm.deadline) {
+		DBG_PRINTF(DBG_LVL_LOW, "Timeout in transmission step %d\n",
+				dev->tx_sm.state);
+		return ERR_RFM_TIMEOUT;
+	}
+	dev->tx_sm.due = now + _wait_slice(dev);
+
+	return ERR_OK;
+}
+
+/**
+ * Arm timer for the next due step, or disarm it when done
+ */
+static int _tx_sm_arm(rf_dev_t *dev)
+{
+	rf_tx_sm_t *sm = &dev->tx_sm;
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+	if (sm->state != TX_STATE_IDLE) {
+		// Zero disarms the timer
+		time_ns_to_ts((sm->due != 0) ? sm->due : 1, &its.it_value);
+	}
+
+	if (timerfd_settime(sm->fd, TFD_TIMER_ABSTIME, &its, NULL) != 0) {
+		return ERR_TIMER;
+	}
+
+	return ERR_OK;
+}
+
+/**
+ * End non-blocking transmission after an error
+ */
+static void _tx_sm_abort(rf_dev_t *dev)
+{
+	rf_tx_sm_t *sm = &dev->tx_sm;
+	int state = sm->state;
+
+	sm->state = TX_STATE_IDLE;
+	if (sm->fd >= 0) {
+		_tx_sm_arm(dev);
+	}
+
+	if (state == TX_STATE_REFILL || state == TX_STATE_DRAIN) {
+		if (dev->auto_modes) {
+			dev->tx_pending = true;
+			dev->tx_end = sm->due;
+		} else {
+			_switch_mode(dev, sm->idle);
+		}
+	}
+
+	if (state != TX_STATE_IDLE) {
+		_unlock(dev);
+	}
+}
+
+/**
+ * Get DIO pin attached to an interrupt flag
+ *
+ * @returns	GPIO line of DIO pin, or NULL if no line is attached
+ */
+static gpio_line_t *_flag_dio(rf_dev_t *dev, uint8_t reg, uint8_t flag)
+{
+	int dio = -1;
+
+	if (reg == RegIrqFlags1 && flag == IRQ_FLAGS1_MODEREADY) {
+		dio = RF_DIO_MODEREADY;
+	} else if (reg == RegIrqFlags2 && flag == IRQ_FLAGS2_FIFOLEVEL) {
+		dio = RF_DIO_FIFOLEVEL;
+	} else if (reg == RegIrqFlags2 && flag == IRQ_FLAGS2_PACKETSENT) {
+		dio = RF_DIO_PACKETSENT;
+	}
+
+	if (dio < 0 || dev->dio[dio].ops == NULL) {
+		return NULL;
+	}
+
+	return &dev->dio[dio];
+}
+
+/**
+ * CPU time used by calling thread, in ns
+ */
+static uint64_t _thread_cpu_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return time_ts_to_ns(&ts);
+}
+
+/**
+ * Time to wake up before a deadline, to compensate for wake-up latency
+ */
+static uint64_t _wait_margin(rf_dev_t *dev)
+{
+	rf_wait_stats_t *stats = &dev->wait_stats[dev->wait_strategy];
+	uint64_t margin = WAIT_MARGIN_MIN_NS;
+
+	if (stats->sleeps != 0) {
+		margin += 2 * stats->wake_latency_total / stats->sleeps;
+	}
+
+	return (margin > WAIT_MARGIN_MAX_NS) ? WAIT_MARGIN_MAX_NS : margin;
+}
+
+/**
+ * Sleep time between polls, when not spinning
+ */
+static uint64_t _wait_slice(rf_dev_t *dev)
+{
+	uint64_t slice = dev->byte_time / 2;
+
+	if (slice < WAIT_SLICE_MIN_NS) {
+		return WAIT_SLICE_MIN_NS;
+	}
+
+	return (slice > WAIT_SLICE_MAX_NS) ? WAIT_SLICE_MAX_NS : slice;
+}
+
+/**
+ * Sleep till deadline and record wake-up latency
+ */
+static void _wait_sleep(rf_dev_t *dev, uint64_t deadline)
+{
+	rf_wait_stats_t *stats = &dev->wait_stats[dev->wait_strategy];
+	uint64_t latency;
+
+	time_sleep_until_ns(deadline);
+	latency = time_now_ns() - deadline;
+
+	pthread_mutex_lock(&dev->lock);
+	stats->sleeps++;
+	stats->wake_latency_total += latency;
+	if (latency > stats->wake_latency_max) {
+		stats->wake_latency_max = latency;
+	}
+	pthread_mutex_unlock(&dev->lock);
+}
+
+/**
+ * Record time and CPU time spend in a wait
+ */
+static void _wait_account(rf_dev_t *dev, uint64_t start, uint64_t cpu_start)
+{
+	rf_wait_stats_t *stats = &dev->wait_stats[dev->wait_strategy];
+	uint64_t wait_time = time_now_ns() - start;
+	uint64_t cpu_time = _thread_cpu_time() - cpu_start;
+
+	pthread_mutex_lock(&dev->lock);
+	stats->waits++;
+	stats->wait_time += wait_time;
+	stats->cpu_time += cpu_time;
+	pthread_mutex_unlock(&dev->lock);
+}
+
+/**
+ * Wait till deadline, according to the wait strategy
+ */
+static void _wait_until(rf_dev_t *dev, uint64_t deadline)
+{
+	uint64_t start = time_now_ns();
+	uint64_t cpu_start = _thread_cpu_time();
+	uint64_t margin;
+
+	if (start >= deadline) {
+		return;
+	}
+
+	if (dev->wait_strategy != RF_WAIT_SPIN) {
+		margin = _wait_margin(dev);
+		if (deadline - start > margin) {
+			_wait_sleep(dev, deadline - margin);
+		}
+	}
+
+	while (time_now_ns() < deadline);
+
+	_wait_account(dev, start, cpu_start);
+}
+
+/**
+ * Wait till trigger time as precisely as possible
+ *
+ * Independent of the wait strategy, sleeps till just before the trigger time
+ * and spins for the rest.
+ */
+static void _wait_trigger(rf_dev_t *dev, uint64_t trigger)
+{
+	rf_wait_stats_t *stats = &dev->wait_stats[dev->wait_strategy];
+	uint64_t now = time_now_ns();
+	uint64_t margin = WAIT_MARGIN_MAX_NS;
+
+	// Wake up before the worst seen wake-up latency, spinning is cheaper
+	// than missing the trigger time
+	if (stats->sleeps != 0) {
+		margin = _wait_margin(dev);
+		if (margin < WAIT_MARGIN_MIN_NS + stats->wake_latency_max) {
+			margin = WAIT_MARGIN_MIN_NS + stats->wake_latency_max;
+		}
+	}
+
+	if (now >= trigger) {
+		return;
+	}
+
+	if (trigger - now > margin) {
+		_wait_sleep(dev, trigger - margin);
+	}
+
+	while (time_now_ns() < trigger);
+}
+
+/**
+ * Wait till interrupt flag is set or cleared
+ *
+ * If a GPIO line is attached to the DIO pin mapped to the flag, wait for
+ * line events. Else poll the flag register according to the wait strategy.
+ *
+ * @param dev		Device handle
+ * @param reg		Flag register, RegIrqFlags1 or RegIrqFlags2
+ * @param flag		Flag to wait for
+ * @param set		If True wait till flag is set, else till cleared
+ * @param expect	Time at which flag is expected to change, or 0 if
+ *			unknown. Used by RF_WAIT_SLEEP.
+ * @param deadline	Time after which the module is considered stuck, see
+ *			_wait_deadline()
+ *
+ * On return dev->flag_mark holds the last time the flag was seen unchanged,
+ * ie. the earliest time it could have changed.
+ *
+ * @returns	0 on success, ERR_RFM_TIMEOUT if the flag didn't change before
+ *		the deadline
+ */
+static int _wait_flag(rf_dev_t *dev, uint8_t reg, uint8_t flag, bool set,
+				uint64_t expect, uint64_t deadline)
+{
+	int err = ERR_UNSPEC;
+	uint64_t start = time_now_ns();
+	uint64_t cpu_start = _thread_cpu_time();
+	uint64_t now;
+	gpio_line_t *line;
+	uint8_t val;
+	int value;
+
+	dev->flag_mark = start;
+
+	line = _flag_dio(dev, reg, flag);
+	if (line != NULL) {
+		while (true) {
+			TRY(gpio_get(line, &value));
+			_stats_inc(&dev->stats.polls);
+			if ((value != 0) == set) {
+				break;
+			}
+			now = time_now_ns();
+			if (now > deadline) {
+				err = ERR_RFM_TIMEOUT;
+				goto fail;
+			}
+			TRY(gpio_wait(line, (deadline - now + NSEC_PER_MSEC - 1) /
+						NSEC_PER_MSEC));
+			dev->flag_mark = time_now_ns();
+		}
+	} else {
+		if (dev->wait_strategy == RF_WAIT_SLEEP &&
+				expect > start + _wait_margin(dev)) {
+			_wait_sleep(dev, expect - _wait_margin(dev));
+
+			// Flag is not expected to change before this
+			dev->flag_mark = expect - _wait_margin(dev);
+		}
+
+		while (true) {
+			now = time_now_ns();
+			TRY(spi_read_reg(&dev->spi, reg, &val));
+			_stats_inc(&dev->stats.polls);
+			if (((val & flag) != 0) == set) {
+				break;
+			}
+			if (now > deadline) {
+				err = ERR_RFM_TIMEOUT;
+				goto fail;
+			}
+			dev->flag_mark = now;
+
+			if (dev->wait_strategy != RF_WAIT_SPIN &&
+					now - start > WAIT_SPIN_NS) {
+				_wait_sleep(dev, now + _wait_slice(dev));
+			}
+		}
+	}
+
+	_wait_account(dev, start, cpu_start);
+
+	return ERR_OK;
+fail:
+	if (err == ERR_RFM_TIMEOUT) {
+		DBG_PRINTF(DBG_LVL_LOW, "Timeout waiting for flag 0x%02x in "
+				"register 0x%02x\n", flag, reg);
+	}
+	return err;
+}
+
+/**
+ * Calculate deadline for _wait_flag()
+ *
+ * The expected time is based on a FIFO level estimate, which might be off
+ * by up to a full FIFO. So the deadline allows some bytes to be sent after
+ * the expected time, plus WAIT_TIMEOUT_NS slack for scheduling delays. Mode
+ * switches are covered by the slack.
+ *
+ * @param dev		Device handle
+ * @param expect	Time at which flag is expected to change, or 0 if
+ *			unknown
+ * @param bytes		Amount of bytes that might be sent after expect
+ */
+static uint64_t _wait_deadline(rf_dev_t *dev, uint64_t expect, size_t bytes)
+{
+	uint64_t now = time_now_ns();
+
+	if (expect < now) {
+		expect = now;
+	}
+
+	return expect + bytes * dev->byte_time + WAIT_TIMEOUT_NS;
+}
+
+/**
+ * Write data to FIFO, checking for an underrun in the same transfer
+ *
+ * If FifoNotEmpty is cleared before the refill, the FIFO ran empty and the
+ * transmitted data is no longer continuous.
+ *
+ * @param dev		Device handle
+ * @param buf		Data to write
+ * @param len		Length of data
+ * @param headroom	Estimated FIFO level at the refill, for statistics
+ *
+ * @returns	0 on success, ERR_RFM_TX_OUT_OF_SYNC if the FIFO ran empty
+ */
+static int _fifo_refill(rf_dev_t *dev, const uint8_t *buf, size_t len,
+				unsigned int headroom)
+{
+	int err = ERR_UNSPEC;
+	uint8_t val;
+	spi_txn_t txn;
+
+	spi_txn_init(&txn);
+	spi_txn_read(&txn, RegIrqFlags2, &val, 1);
+	spi_txn_write(&txn, RegFifo, buf, len);
+	TRY(spi_txn_submit(&dev->spi, &txn));
+	RF_PROBE3(fifo__refill, len, headroom,
+			!(val & IRQ_FLAGS2_FIFONOTEMPTY));
+
+	if (! (val & IRQ_FLAGS2_FIFONOTEMPTY)) {
+		TRACE(&dev->spi.trace, TRACE_UNDERRUN, 0, 0, NULL, len);
+		DBG_PRINTF(DBG_LVL_LOW, "FIFO underrun\n");
+		_stats_inc(&dev->stats.underruns);
+		_stats_refill(dev, 0);
+		return ERR_RFM_TX_OUT_OF_SYNC;
+	}
+	TRACE(&dev->spi.trace, TRACE_REFILL, 0, headroom, NULL, len);
+	_stats_refill(dev, headroom);
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+/**
+ * Estimate FIFO level at a refill
+ *
+ * @param dev	Device handle
+ * @param mark	Last time the FIFO was known to hold more than the threshold
+ */
+static unsigned int _refill_headroom(rf_dev_t *dev, uint64_t mark)
+{
+	uint64_t now = time_now_ns();
+	uint64_t sent = 0;
+
+	if (now > mark) {
+		sent = (now - mark) / dev->byte_time;
+	}
+
+	return (sent <= dev->fifo_thresh) ? dev->fifo_thresh + 1 - sent : 0;
+}
+
+/**
+ * Feed remaining data to FIFO, polling FIFO level before every refill
+ */
+static int _send_polled(rf_dev_t *dev, tx_source_t *src, size_t prefill_len,
+				uint64_t tx_start)
+{
+	int err = ERR_UNSPEC;
+	uint8_t buf[SX1231_FIFO_SIZE];
+	size_t send_len;
+	uint64_t expect;
+	uint64_t now;
+
+	// FIFO is expected to drain below threshold after the bytes above the
+	// threshold are sent. This assumes the FIFO was at the threshold
+	// level when refilled.
+	expect = tx_start;
+	if (prefill_len > dev->fifo_thresh) {
+		expect += (prefill_len - dev->fifo_thresh) * dev->byte_time;
+	}
+
+	while (src->remaining != 0) {
+		// Wait till space in FIFO
+		TRY(_wait_flag(dev, RegIrqFlags2, IRQ_FLAGS2_FIFOLEVEL, false,
+				expect, _wait_deadline(dev, expect,
+							SX1231_FIFO_SIZE)));
+
+		// Refill Fifo
+		send_len = SX1231_FIFO_SIZE - dev->fifo_thresh;
+		if (src->remaining < send_len) {
+			send_len = src->remaining;
+		}
+		_source_read(src, buf, send_len);
+		TRY(_fifo_refill(dev, buf, send_len,
+				_refill_headroom(dev, dev->flag_mark)));
+
+		now = time_now_ns();
+		_latency_add_shared(dev, &dev->refill_latency,
+				now - dev->flag_mark);
+
+		expect = now + send_len * dev->byte_time;
+	}
+
+	// Wait till done
+	expect += dev->fifo_thresh * dev->byte_time;
+	if (dev->auto_modes) {
+		dev->tx_end = expect;
+	} else {
+		TRY(_wait_flag(dev, RegIrqFlags2, IRQ_FLAGS2_PACKETSENT, true,
+				expect, _wait_deadline(dev, expect,
+							SX1231_FIFO_SIZE)));
+	}
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+/**
+ * Amount of bytes predicted to be in FIFO at a given time
+ */
+static size_t _fifo_model_level(const fifo_model_t *model, uint64_t now)
+{
+	uint64_t sent = 0;
+
+	if (now > model->start) {
+		sent = (now - model->start) / model->byte_time;
+	}
+
+	return (sent < model->written) ? model->written - sent : 0;
+}
+
+/**
+ * Time at which FIFO is predicted to drain to a given level
+ */
+static uint64_t _fifo_model_time_at(const fifo_model_t *model, size_t level)
+{
+	if (level >= model->written) {
+		return model->start;
+	}
+
+	return model->start + (model->written - level) * model->byte_time;
+}
+
+/**
+ * Shift model so that it predicts a given FIFO level at a given time
+ */
+static void _fifo_model_correct(fifo_model_t *model, uint64_t now, size_t level)
+{
+	if (level > model->written) {
+		level = model->written;
+	}
+
+	model->start = now - (model->written - level) * model->byte_time;
+}
+
+/**
+ * Refill FIFO at the time the model predicts space for the data
+ *
+ * The flags are read in the same transfer, just before the refill, to detect
+ * underruns. Every PREDICT_CHECK_INTERVAL refills they are also used to
+ * correct the model for clock drift.
+ *
+ * @param dev		Device handle
+ * @param model		FIFO model, updated for the written data
+ * @param buf		Data to write
+ * @param len		Length of data
+ * @param due		Time the model predicted space for the data
+ * @param refill_cnt	Number of this refill in the transmission, from 1
+ *
+ * @returns	0 on success, ERR_RFM_TX_OUT_OF_SYNC if the FIFO ran empty
+ */
+static int _predict_refill(rf_dev_t *dev, fifo_model_t *model,
+				const uint8_t *buf, size_t len, uint64_t due,
+				unsigned int refill_cnt)
+{
+	int err = ERR_UNSPEC;
+	uint64_t now = time_now_ns();
+	size_t level;
+	uint8_t val;
+	spi_txn_t txn;
+
+	spi_txn_init(&txn);
+	spi_txn_read(&txn, RegIrqFlags2, &val, 1);
+	spi_txn_write(&txn, RegFifo, buf, len);
+	TRY(spi_txn_submit(&dev->spi, &txn));
+	level = _fifo_model_level(model, now);
+	RF_PROBE3(fifo__refill, len, level, !(val & IRQ_FLAGS2_FIFONOTEMPTY));
+	if (! (val & IRQ_FLAGS2_FIFONOTEMPTY)) {
+		TRACE(&dev->spi.trace, TRACE_UNDERRUN, 0, 0, NULL, len);
+		DBG_PRINTF(DBG_LVL_LOW, "FIFO underrun\n");
+		_stats_inc(&dev->stats.underruns);
+		_stats_refill(dev, 0);
+		return ERR_RFM_TX_OUT_OF_SYNC;
+	}
+	TRACE(&dev->spi.trace, TRACE_REFILL, 0, level, NULL, len);
+	_stats_refill(dev, level);
+
+	// FIFO holds at least the threshold level at the due time, so the time
+	// to refill after it is the refill latency
+	_latency_add_shared(dev, &dev->refill_latency, time_now_ns() - due);
+
+	if (refill_cnt % PREDICT_CHECK_INTERVAL == 0) {
+		if ((val & IRQ_FLAGS2_FIFOLEVEL) && level <= dev->fifo_thresh) {
+			// Transmission is behind prediction
+			_fifo_model_correct(model, now, dev->fifo_thresh + 1);
+			DBG_PRINTF(DBG_LVL_HIGH, "FIFO prediction corrected, "
+					"%zu -> %u bytes\n",
+					level, dev->fifo_thresh + 1);
+		} else if (!(val & IRQ_FLAGS2_FIFOLEVEL) &&
+				level > dev->fifo_thresh) {
+			// Transmission is ahead of prediction
+			_fifo_model_correct(model, now, dev->fifo_thresh);
+			DBG_PRINTF(DBG_LVL_HIGH, "FIFO prediction corrected, "
+					"%zu -> %u bytes\n",
+					level, dev->fifo_thresh);
+		}
+	}
+
+	model->written += len;
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+/**
+ * Feed remaining data to FIFO, predicting FIFO level from the bit rate
+ *
+ * Instead of polling the FIFO level flag before every refill, the amount of
+ * bytes drained from the FIFO is calculated from the time since the start of
+ * the transmission, see _predict_refill().
+ */
+static int _send_predicted(rf_dev_t *dev, tx_source_t *src, size_t prefill_len,
+				uint64_t tx_start)
+{
+	int err = ERR_UNSPEC;
+	uint8_t buf[SX1231_FIFO_SIZE];
+	fifo_model_t model;
+	unsigned int refill_cnt = 0;
+	size_t chunk_len;
+	size_t send_len;
+	size_t level;
+	uint64_t now;
+	uint64_t due;
+
+	// Transmission starts no later than tx_start. This makes the model
+	// underestimate the drained bytes.
+	model.start = tx_start;
+	model.byte_time = dev->byte_time;
+	model.written = prefill_len;
+
+	chunk_len = SX1231_FIFO_SIZE - PREDICT_MARGIN - dev->fifo_thresh;
+
+	while (src->remaining != 0) {
+		send_len = (src->remaining < chunk_len) ?
+				src->remaining : chunk_len;
+
+		// Wait till predicted space in FIFO
+		level = SX1231_FIFO_SIZE - PREDICT_MARGIN - send_len;
+		due = _fifo_model_time_at(&model, level);
+		_wait_until(dev, due);
+
+		refill_cnt++;
+		_source_read(src, buf, send_len);
+		TRY(_predict_refill(dev, &model, buf, send_len, due,
+					refill_cnt));
+	}
+
+	// Wait till predicted done, last byte is still in the shift register
+	now = _fifo_model_time_at(&model, 0) + model.byte_time;
+	if (dev->auto_modes) {
+		dev->tx_end = now;
+		return ERR_OK;
+	}
+	_wait_until(dev, now);
+
+	// The model runs behind the transmission, so normally a single read
+	// finds PacketSent set
+	TRY(_wait_flag(dev, RegIrqFlags2, IRQ_FLAGS2_PACKETSENT, true, now,
+				_wait_deadline(dev, now, SX1231_FIFO_SIZE)));
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+/**
+ * Increment statistics counter
+ */
+static void _stats_inc(atomic_ulong *cnt)
+{
+	atomic_fetch_add_explicit(cnt, 1, memory_order_relaxed);
+}
+
+/**
+ * Account FIFO refill in statistics
+ *
+ * @param dev		Device handle
+ * @param headroom	FIFO level at the refill, in bytes
+ */
+static void _stats_refill(rf_dev_t *dev, unsigned int headroom)
+{
+	unsigned int min;
+
+	_stats_inc(&dev->stats.refills);
+
+	min = atomic_load_explicit(&dev->stats.min_headroom,
+				memory_order_relaxed);
+	while (headroom < min) {
+		// On failure min is updated to the current value
+		if (atomic_compare_exchange_weak_explicit(
+					&dev->stats.min_headroom, &min,
+					headroom, memory_order_relaxed,
+					memory_order_relaxed)) {
+			break;
+		}
+	}
+}
+
+/**
+ * Account completed transmission in statistics
+ *
+ * @param dev		Device handle
+ * @param start		Time the transmission was requested
+ * @param len		Amount of bytes transmitted
+ */
+static void _stats_send(rf_dev_t *dev, uint64_t start, size_t len)
+{
+	_stats_inc(&dev->stats.sends);
+	atomic_fetch_add_explicit(&dev->stats.airtime,
+				dev->header_time + len * dev->byte_time,
+				memory_order_relaxed);
+	_hist_add(dev->stats.send_time, time_now_ns() - start);
+}
+
+/**
+ * Add sample to histogram, see rf_hist_t
+ *
+ * @param hist		Histogram buckets
+ * @param sample	Sample in ns
+ */
+static void _hist_add(atomic_ulong *hist, uint64_t sample)
+{
+	uint64_t us = sample / NSEC_PER_USEC;
+	unsigned int i = 0;
+
+	while (us >= 2 && i < RF_HIST_BUCKETS - 1) {
+		us >>= 1;
+		i++;
+	}
+
+	_stats_inc(&hist[i]);
+}
+
+/**
+ * Add sample to latency statistics
+ *
+ * Uses Welford's online algorithm for the mean and variance.
+ */
+static void _latency_add(rf_latency_t *stats, uint64_t sample)
+{
+	double delta;
+
+	stats->count++;
+	delta = sample - stats->mean;
+	stats->mean += delta / stats->count;
+	stats->m2 += delta * (sample - stats->mean);
+	if (sample > stats->max) {
+		stats->max = sample;
+	}
+}
+
+/**
+ * Add sample to latency statistics that getters read from other threads
+ */
+static void _latency_add_shared(rf_dev_t *dev, rf_latency_t *stats,
+				uint64_t sample)
+{
+	pthread_mutex_lock(&dev->lock);
+	_latency_add(stats, sample);
+	pthread_mutex_unlock(&dev->lock);
+}
+
+/**
+ * Choose FIFO threshold from measured refill latency
+ *
+ * When the FIFO level drops to the threshold the refill must complete before
+ * the remaining bytes are sent. The latency distribution is unknown, so
+ * Cantelli's inequality is used: P(X >= mean + k * stddev) <= 1 / (1 + k^2).
+ * The threshold is set to the amount of bytes sent in mean + k * stddev, with
+ * k chosen for the configured underrun probability. The refill chunk size
+ * follows from the threshold.
+ *
+ * Returns TUNE_THRESH_DEFAULT if tuning is disabled or not enough samples are
+ * available.
+ */
+static uint8_t _choose_fifo_thresh(rf_dev_t *dev)
+{
+	const rf_latency_t *lat = &dev->refill_latency;
+	double k;
+	double stddev;
+	double headroom;
+
+	if (dev->underrun_prob == 0 || lat->count < TUNE_MIN_SAMPLES ||
+			dev->byte_time == 0) {
+		return TUNE_THRESH_DEFAULT;
+	}
+
+	k = sqrt(1 / dev->underrun_prob - 1);
+	stddev = sqrt(lat->m2 / (lat->count - 1));
+	headroom = lat->mean + k * stddev;
+
+	// One extra byte for the byte being shifted out
+	headroom = ceil(headroom / dev->byte_time) + 1;
+	if (headroom < TUNE_THRESH_MIN) {
+		return TUNE_THRESH_MIN;
+	} else if (headroom > TUNE_THRESH_MAX) {
+		DBG_PRINTF(DBG_LVL_LOW, "FIFO threshold of %.0f bytes "
+				"needed for underrun target, using %u\n",
+				headroom, TUNE_THRESH_MAX);
+		return TUNE_THRESH_MAX;
+	}
+
+	return headroom;
+}
+
+/**
+ * Apply FIFO threshold from _choose_fifo_thresh() if it changed
+ */
+static int _tune_fifo_thresh(rf_dev_t *dev)
+{
+	int err = ERR_UNSPEC;
+	const rf_latency_t *lat = &dev->refill_latency;
+	uint8_t thresh;
+	spi_txn_t txn;
+
+	thresh = _choose_fifo_thresh(dev);
+	if (thresh == dev->fifo_thresh) {
+		return ERR_OK;
+	}
+
+	// Keep TxStartCondition
+	spi_txn_init(&txn);
+	_txn_write_shadow_reg(dev, &txn, RegFifoThresh, 0x80 | thresh);
+	TRY(_shadow_submit(dev, &txn));
+	_set_fifo_thresh(dev, thresh);
+
+	DBG_PRINTF(DBG_LVL_MID, "FIFO threshold %u bytes, refill chunk %u "
+			"bytes (latency mean %.1f us, stddev %.1f us)\n",
+			thresh, SX1231_FIFO_SIZE - thresh, lat->mean / 1e3,
+			(lat->count > 1) ? sqrt(lat->m2 / (lat->count - 1)) / 1e3 : 0);
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+/**
+ * Set dev->fifo_thresh, which rf_get_fifo_tuning() reads from other threads
+ */
+static void _set_fifo_thresh(rf_dev_t *dev, uint8_t thresh)
+{
+	pthread_mutex_lock(&dev->lock);
+	dev->fifo_thresh = thresh;
+	pthread_mutex_unlock(&dev->lock);
+}
+
+/**
+ * Bring module in a known state
+ *
+ * The reset pin of the module isn't connected, so instead the module is put
+ * in standby mode with automatic modes disabled, and the FIFO is cleared. All
+ * of it in a single SPI transfer.
+ */
+static int _reset(rf_dev_t *dev)
+{
+	spi_txn_t txn;
+
+	spi_txn_init(&txn);
+
+	// The intermediate mode of automatic modes overrides RegOpMode
+	_txn_write_shadow_reg(dev, &txn, RegAutoModes, 0x00);
+
+	// Writing FifoOverrun clears the FIFO
+	spi_txn_write_reg(&txn, RegIrqFlags2, IRQ_FLAGS2_FIFOOVERRUN);
+
+	dev->tx_pending = false;
+
+	return _switch_mode_txn(dev, &txn, OP_MODE_MODE_STDBY);
+}
+
+/**
+ * Recover from a stuck module or FIFO underrun
+ *
+ * The module is reset and the configuration is restored from the shadow
+ * registers, so the next transmission starts from a known state.
+ *
+ * @param dev	Device handle
+ * @param err	Error that aborted the transmission, other errors than
+ *		ERR_RFM_TX_OUT_OF_SYNC and ERR_RFM_TIMEOUT are ignored
+ */
+static void _recover(rf_dev_t *dev, int err)
+{
+	uint64_t start = time_now_ns();
+	spi_txn_t txn;
+
+	if (err != ERR_RFM_TX_OUT_OF_SYNC && err != ERR_RFM_TIMEOUT) {
+		return;
+	}
+
+	TRACE(&dev->spi.trace, TRACE_RECOVER, 0, err, NULL, 0);
+	TRY(_reset(dev));
+
+	spi_txn_init(&txn);
+	_txn_write_shadow_reg(dev, &txn, RegAutoModes,
+				dev->auto_modes ? AUTO_MODES_TX : 0x00);
+	if (txn.msg_cnt != 0) {
+		TRY(_shadow_submit(dev, &txn));
+	}
+	TRY(_restore_config(dev));
+
+	DBG_PRINTF(DBG_LVL_LOW, "Module recovered in %.1f us\n",
+			(time_now_ns() - start) / 1e3);
+
+	return;
+fail:
+	DBG_PRINTF(DBG_LVL_LOW, "Module recovery failed: %d\n", err);
+}
+
+/**
+ * Read configuration registers into shadow
+ *
+ * All configuration registers, including RegVersion, are read in a single
+ * burst. If the module is still configured by a previous user, rf_config()
+ * then has nothing left to write.
+ */
+static int _sync_config(rf_dev_t *dev)
+{
+	int err = ERR_UNSPEC;
+	spi_txn_t txn;
+	unsigned int reg;
+
+	spi_txn_init(&txn);
+	spi_txn_read(&txn, SHADOW_SYNC_FIRST, &dev->shadow[SHADOW_SYNC_FIRST],
+			SHADOW_SYNC_LAST - SHADOW_SYNC_FIRST + 1);
+	TRY(spi_txn_submit(&dev->spi, &txn));
+
+	for (reg = SHADOW_SYNC_FIRST; reg <= SHADOW_SYNC_LAST; reg++) {
+		if (_reg_is_volatile(reg)) {
+			continue;
+		}
+		dev->shadow_valid[reg / 8] |= 1 << (reg % 8);
+	}
+
+	dev->fifo_thresh = dev->shadow[RegFifoThresh] & 0x7f;
+	_update_byte_time(dev);
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+/**
+ * Take exclusive access to the module
+ *
+ * Threads are served in the order they call this function, using a ticket
+ * lock. The lock is recursive, so public functions can call each other. When
+ * taking the flock on the SPI device, another process might have used the
+ * module in the meantime, so the configuration is restored. The generation
+ * counter shared with those processes tells if one did, so the readback
+ * _restore_config() costs is only paid after another process took the flock.
+ * Without the shared counter it is paid on every top-level call.
+ */
+static int _lock(rf_dev_t *dev)
+{
+	int err = ERR_UNSPEC;
+	pthread_t self = pthread_self();
+	uint64_t start = time_now_ns();
+	unsigned long ticket;
+	bool restore = false;
+
+	pthread_mutex_lock(&dev->lock);
+	if (dev->lock_depth != 0 && pthread_equal(dev->lock_owner, self)) {
+		dev->lock_depth++;
+		pthread_mutex_unlock(&dev->lock);
+		return ERR_OK;
+	}
+	ticket = dev->lock_next++;
+	while (ticket != dev->lock_serving) {
+		pthread_cond_wait(&dev->lock_cond, &dev->lock);
+	}
+	dev->lock_owner = self;
+	dev->lock_depth = 1;
+	pthread_mutex_unlock(&dev->lock);
+
+	if (!dev->flock_held && dev->spi.fd >= 0) {
+		while (flock(dev->spi.fd, LOCK_EX) != 0) {
+			if (errno != EINTR) {
+				err = ERR_LOCK;
+				goto fail;
+			}
+		}
+		dev->flock_held = true;
+
+		if (dev->lock_gen_shared != NULL) {
+			restore = (*dev->lock_gen_shared != dev->lock_gen);
+			dev->lock_gen = ++*dev->lock_gen_shared;
+		} else {
+			restore = true;
+		}
+	}
+
+	pthread_mutex_lock(&dev->lock);
+	dev->lock_wait = time_now_ns() - start;
+	_latency_add(&dev->lock_wait_stats, dev->lock_wait);
+	pthread_mutex_unlock(&dev->lock);
+
+	if (restore) {
+		TRY(_restore_config(dev));
+	}
+
+	return ERR_OK;
+fail:
+	_unlock(dev);
+	return err;
+}
+
+/**
+ * Map the flock generation counter of the SPI device
+ *
+ * Processes using this library increment the counter each time they take
+ * the flock. The counter lives in a file in /dev/shm named after the device
+ * number, so all paths to the device share it. Changes by programs not using
+ * this library go unnoticed. Without the counter every flock checks the
+ * configuration.
+ */
+static void _lock_gen_map(rf_dev_t *dev)
+{
+	char path[64];
+	struct stat st;
+	mode_t mode;
+	void *map;
+	int fd;
+
+	if (dev->spi.fd < 0 || fstat(dev->spi.fd, &st) != 0 ||
+			!S_ISCHR(st.st_mode)) {
+		return;
+	}
+
+	snprintf(path, sizeof(path), "/dev/shm/sx1231_ods.%u.%u",
+			major(st.st_rdev), minor(st.st_rdev));
+	mode = st.st_mode & 0666;
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, mode);
+	if (fd < 0) {
+		DBG_PRINTF(DBG_LVL_LOW, "Failed to open %s: %s\n", path,
+				strerror(errno));
+		return;
+	}
+
+	// Whoever may use the device may use the counter, despite the umask.
+	// Fails harmlessly if another user created the file.
+	fchmod(fd, mode);
+
+	// Only grow the file, another process might be using it already
+	if (fstat(fd, &st) != 0 ||
+			(st.st_size < (off_t)sizeof(uint64_t) &&
+			ftruncate(fd, sizeof(uint64_t)) != 0)) {
+		DBG_PRINTF(DBG_LVL_LOW, "Failed to size %s: %s\n", path,
+				strerror(errno));
+		close(fd);
+		return;
+	}
+
+	map = mmap(NULL, sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		DBG_PRINTF(DBG_LVL_LOW, "Failed to map %s: %s\n", path,
+				strerror(errno));
+		return;
+	}
+
+	dev->lock_gen_shared = map;
+
+	// Configuration is read without the flock, so check it on first use
+	dev->lock_gen = UINT64_MAX;
+}
+
+/**
+ * Release access to the module taken with _lock()
+ */
+static void _unlock(rf_dev_t *dev)
+{
+	pthread_mutex_lock(&dev->lock);
+	assert(dev->lock_depth != 0);
+	dev->lock_depth--;
+	if (dev->lock_depth == 0) {
+		if (dev->flock_held) {
+			flock(dev->spi.fd, LOCK_UN);
+			dev->flock_held = false;
+		}
+		dev->lock_serving++;
+		pthread_cond_broadcast(&dev->lock_cond);
+	}
+	pthread_mutex_unlock(&dev->lock);
+}
+
+/**
+ * Rewrite configuration registers changed by another process
+ *
+ * First a few registers that any other configuration almost certainly
+ * changes are compared with the shadow registers: modulation, bit rate,
+ * deviation, frequency, PA level and framing. Only if one differs, all
+ * configuration registers are read in a single burst and rewritten where
+ * needed. If the module was left in another mode, it is switched back to the
+ * idle mode. A transmission using automatic modes might still be running,
+ * the registers are only written after it finished.
+ */
+static int _restore_config(rf_dev_t *dev)
+{
+	int err = ERR_UNSPEC;
+	uint8_t regs[SHADOW_SYNC_LAST + 1];
+	uint64_t expect;
+	spi_txn_t txn;
+	unsigned int reg;
+	bool changed;
+
+	spi_txn_init(&txn);
+	spi_txn_read(&txn, RegOpMode, &regs[RegOpMode],
+			RegFrfLsb - RegOpMode + 1);
+	spi_txn_read(&txn, RegPaLevel, &regs[RegPaLevel], 1);
+	spi_txn_read(&txn, RegIrqFlags1, &regs[RegIrqFlags1], 1);
+	spi_txn_read(&txn, RegPreambleMsb, &regs[RegPreambleMsb],
+			RegSyncConfig - RegPreambleMsb + 1);
+	spi_txn_read(&txn, RegPacketConfig1, &regs[RegPacketConfig1], 1);
+	TRY(spi_txn_submit(&dev->spi, &txn));
+
+	changed = _config_changed(dev, regs, RegDataModul, RegFrfLsb) ||
+		_config_changed(dev, regs, RegPaLevel, RegPaLevel) ||
+		_config_changed(dev, regs, RegPreambleMsb, RegSyncConfig) ||
+		_config_changed(dev, regs, RegPacketConfig1, RegPacketConfig1);
+	if (changed) {
+		spi_txn_init(&txn);
+		spi_txn_read(&txn, SHADOW_SYNC_FIRST,
+				&regs[SHADOW_SYNC_FIRST],
+				SHADOW_SYNC_LAST - SHADOW_SYNC_FIRST + 1);
+		TRY(spi_txn_submit(&dev->spi, &txn));
+	}
+
+	if (regs[RegIrqFlags1] & IRQ_FLAGS1_AUTOMODE) {
+		expect = dev->tx_pending ? dev->tx_end : 0;
+		TRY(_wait_flag(dev, RegIrqFlags1, IRQ_FLAGS1_AUTOMODE, false,
+				expect, _wait_deadline(dev, expect,
+							SX1231_FIFO_SIZE)));
+	}
+
+	spi_txn_init(&txn);
+	for (reg = SHADOW_SYNC_FIRST; changed && reg <= SHADOW_SYNC_LAST;
+			reg++) {
+		if (reg == RegOpMode || _reg_is_volatile(reg) ||
+				!(dev->shadow_valid[reg / 8] & (1 << (reg % 8))) ||
+				regs[reg] == dev->shadow[reg]) {
+			continue;
+		}
+		spi_txn_write_reg(&txn, reg, dev->shadow[reg]);
+	}
+	if (txn.msg_cnt != 0) {
+		DBG_PRINTF(DBG_LVL_MID, "Restoring configuration changed by "
+				"other process\n");
+		TRY(_shadow_submit(dev, &txn));
+	}
+
+	dev->shadow[RegOpMode] = regs[RegOpMode];
+	dev->shadow_valid[RegOpMode / 8] |= 1 << (RegOpMode % 8);
+	if (!_shadow_is(dev, RegOpMode, _idle_mode(dev))) {
+		TRY(_switch_mode(dev, _idle_mode(dev)));
+	}
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+/**
+ * Check if a range of registers read from the module differs from the shadow
+ */
+static bool _config_changed(rf_dev_t *dev, const uint8_t *regs,
+				uint8_t first, uint8_t last)
+{
+	for (unsigned int reg = first; reg <= last; reg++) {
+		if ((dev->shadow_valid[reg / 8] & (1 << (reg % 8))) &&
+				regs[reg] != dev->shadow[reg]) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Check if register can change without being written
+ */
+static bool _reg_is_volatile(uint8_t reg)
+{
+	switch (reg) {
+	case RegOsc1:
+	case RegAfcFei:
+	case RegAfcMsb:
+	case RegAfcLsb:
+	case RegFeiMsb:
+	case RegFeiLsb:
+	case RegRssiConfig:
+	case RegRssiValue:
+	case RegIrqFlags1:
+	case RegIrqFlags2:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int _switch_mode(rf_dev_t *dev, int mode)
+{
+	spi_txn_t txn;
+
+	spi_txn_init(&txn);
+
+	return _switch_mode_txn(dev, &txn, mode);
+}
+
+/**
+ * Switch mode after executing a transaction
+ *
+ * The mode change, and the first check for ModeReady, are appended to the
+ * transaction. So all of it is executed in a single SPI transfer.
+ */
+static int _switch_mode_txn(rf_dev_t *dev, spi_txn_t *txn, int mode)
+{
+	int err = ERR_UNSPEC;
+	uint64_t start = time_now_ns();
+	uint64_t duration;
+	uint8_t val;
+
+	assert((mode & ~0x1c) == 0);
+
+	RF_PROBE3(mode__switch__start, dev->shadow[RegOpMode] & 0x1c, mode,
+			start);
+	TRACE(&dev->spi.trace, TRACE_MODE, dev->shadow[RegOpMode] & 0x1c, mode,
+			NULL, 0);
+
+	// Always written, the mode might have changed without a write
+	spi_txn_write_reg(txn, RegOpMode, mode);
+	spi_txn_read(txn, RegIrqFlags1, &val, 1);
+	dev->shadow[RegOpMode] = mode;
+	dev->shadow_valid[RegOpMode / 8] |= 1 << (RegOpMode % 8);
+	TRY(_shadow_submit(dev, txn));
+
+	if (! (val & IRQ_FLAGS1_MODEREADY)) {
+		TRY(_wait_flag(dev, RegIrqFlags1, IRQ_FLAGS1_MODEREADY, true, 0,
+					_wait_deadline(dev, 0, 0)));
+	}
+
+	duration = time_now_ns() - start;
+	atomic_fetch_add_explicit(&dev->stats.mode_switch_time, duration,
+				memory_order_relaxed);
+	_hist_add(dev->stats.mode_switch, duration);
+	RF_PROBE2(mode__switch__done, mode, duration);
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+static void _source_read(tx_source_t *src, uint8_t *buf, size_t len)
+{
+	assert(len <= src->remaining);
+
+	src->read(src, buf, len);
+	src->remaining -= len;
+}
+
+static void _iov_source_read(tx_source_t *src, uint8_t *buf, size_t len)
+{
+	iov_source_t *is = (iov_source_t *) src;
+	size_t n;
+
+	while (len != 0) {
+		n = is->iov->iov_len - is->offset;
+		if (n == 0) {
+			// Next segment, remaining ensures there is one
+			is->iov++;
+			is->offset = 0;
+			continue;
+		}
+		if (n > len) {
+			n = len;
+		}
+
+		memcpy(buf, (const uint8_t *) is->iov->iov_base + is->offset, n);
+		is->offset += n;
+		buf += n;
+		len -= n;
+	}
+}
+
+static void _iov_source_init(iov_source_t *is, const struct iovec *iov,
+				int iovcnt)
+{
+	is->src.read = _iov_source_read;
+	is->src.remaining = _iov_len(iov, iovcnt);
+	is->iov = iov;
+	is->offset = 0;
+}
+
+/**
+ * Total length of a list of buffers
+ */
+static size_t _iov_len(const struct iovec *iov, int iovcnt)
+{
+	size_t len = 0;
+
+	for (int i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+	}
+
+	return len;
+}
+
+/**
+ * Convert gap length to bits, rounded to the nearest bit
+ */
+static size_t _gap_bits(unsigned int gap_us, uint64_t byte_time)
+{
+	return ((uint64_t) gap_us * NSEC_PER_USEC * 8 + byte_time / 2) /
+		byte_time;
+}
+
+/**
+ * Get next bit of frame train
+ *
+ * The gap of the last frame is never reached, as it is not counted in the
+ * train length.
+ */
+static int _train_next_bit(train_source_t *ts)
+{
+	const rf_train_entry_t *e;
+	const struct iovec *seg;
+	int bit;
+
+	while (true) {
+		if (ts->in_gap) {
+			if (ts->bit < ts->gap_bits) {
+				ts->bit++;
+				return 0;
+			}
+			ts->in_gap = false;
+			ts->bit = 0;
+		}
+
+		if (ts->entry >= ts->cnt) {
+			// Padding of last byte
+			return 0;
+		}
+
+		e = &ts->entries[ts->entry];
+		if (ts->repeat >= e->repeat) {
+			ts->entry++;
+			ts->repeat = 0;
+			continue;
+		}
+
+		if (ts->seg < e->iovcnt) {
+			seg = &e->iov[ts->seg];
+			if (ts->bit < seg->iov_len * 8) {
+				bit = ((const uint8_t *) seg->iov_base)[ts->bit / 8];
+				bit = (bit >> (7 - ts->bit % 8)) & 1;
+				ts->bit++;
+				return bit;
+			}
+
+			ts->seg++;
+			ts->bit = 0;
+			continue;
+		}
+
+		// End of frame
+		ts->repeat++;
+		ts->seg = 0;
+		ts->bit = 0;
+		ts->in_gap = true;
+		ts->gap_bits = _gap_bits(e->gap_us, ts->byte_time);
+	}
+}
+
+static void _train_source_read(tx_source_t *src, uint8_t *buf, size_t len)
+{
+	train_source_t *ts = (train_source_t *) src;
+	uint8_t b;
+
+	for (size_t i = 0; i < len; i++) {
+		b = 0;
+		for (int j = 0; j < 8; j++) {
+			b = (b << 1) | _train_next_bit(ts);
+		}
+		buf[i] = b;
+	}
+}
+
+static void _train_source_init(train_source_t *ts,
+				const rf_train_entry_t *entries, size_t cnt,
+				uint64_t byte_time)
+{
+	size_t bits = 0;
+	size_t last_gap = 0;
+
+	for (size_t i = 0; i < cnt; i++) {
+		if (entries[i].repeat == 0) {
+			continue;
+		}
+		last_gap = _gap_bits(entries[i].gap_us, byte_time);
+		bits += entries[i].repeat *
+			(_iov_len(entries[i].iov, entries[i].iovcnt) * 8 +
+			 last_gap);
+	}
+	bits -= last_gap;
+
+	ts->src.read = _train_source_read;
+	ts->src.remaining = (bits + 7) / 8;
+	ts->entries = entries;
+	ts->cnt = cnt;
+	ts->entry = 0;
+	ts->repeat = 0;
+	ts->in_gap = false;
+	ts->seg = 0;
+	ts->bit = 0;
+	ts->gap_bits = 0;
+	ts->byte_time = byte_time;
+}
+
+/**
+ * Time from entering TX mode from the current mode till the first bit is sent
+ */
+static uint64_t _tx_startup_time(rf_dev_t *dev)
+{
+	uint64_t t = SX1231_TS_TR_NS;
+
+	t += _pa_ramp_us[dev->shadow[RegPaRamp] & 0x0f] * NSEC_PER_USEC;
+	if (!_shadow_is(dev, RegOpMode, OP_MODE_MODE_FS)) {
+		t += SX1231_TS_FS_NS;
+	}
+	if (_shadow_is(dev, RegOpMode, OP_MODE_MODE_SLEEP)) {
+		t += SX1231_TS_OSC_NS;
+	}
+
+	return t;
+}
+
+/**
+ * Wait for pending transmission with automatic modes to finish
+ *
+ * The module returns to the mode in RegOpMode. After rf_send_at() that is
+ * FS, so the idle mode is entered here. Sleep mode is left to rf_flush(), as
+ * the FIFO can't be used in it.
+ */
+static int _flush(rf_dev_t *dev)
+{
+	int err = ERR_UNSPEC;
+	int idle;
+
+	if (!dev->tx_pending) {
+		return ERR_OK;
+	}
+
+	// The predicted end already includes the last byte, see
+	// _send_predicted()
+	if (dev->refill_mode == RF_REFILL_PREDICT) {
+		_wait_until(dev, dev->tx_end);
+	}
+
+	// AutoMode flag is set while in the intermediate mode
+	TRY(_wait_flag(dev, RegIrqFlags1, IRQ_FLAGS1_AUTOMODE, false,
+				dev->tx_end, _wait_deadline(dev, dev->tx_end,
+							SX1231_FIFO_SIZE)));
+	dev->tx_pending = false;
+
+	idle = _idle_mode(dev);
+	if (idle != OP_MODE_MODE_SLEEP && !_shadow_is(dev, RegOpMode, idle)) {
+		TRY(_switch_mode(dev, idle));
+	}
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+/**
+ * Mode to park the module in between transmissions
+ */
+static int _idle_mode(rf_dev_t *dev)
+{
+	switch (dev->idle_policy) {
+	case RF_IDLE_FS:
+		return OP_MODE_MODE_FS;
+	case RF_IDLE_SLEEP:
+		return OP_MODE_MODE_SLEEP;
+	case RF_IDLE_ADAPTIVE:
+		if (dev->send_interval == 0) {
+			return OP_MODE_MODE_STDBY;
+		} else if (dev->send_interval < IDLE_FS_INTERVAL_NS) {
+			return OP_MODE_MODE_FS;
+		} else if (dev->send_interval < IDLE_STDBY_INTERVAL_NS) {
+			return OP_MODE_MODE_STDBY;
+		}
+		return OP_MODE_MODE_SLEEP;
+	default:
+		return OP_MODE_MODE_STDBY;
+	}
+}
+
+/**
+ * Update moving average of time between rf_send() calls
+ */
+static void _update_send_interval(rf_dev_t *dev, uint64_t now)
+{
+	uint64_t interval;
+
+	if (dev->last_send != 0) {
+		interval = now - dev->last_send;
+		if (dev->send_interval == 0) {
+			dev->send_interval = interval;
+		} else {
+			// Exponential moving average, alpha = 1/4
+			dev->send_interval = dev->send_interval -
+				dev->send_interval / 4 + interval / 4;
+		}
+	}
+	dev->last_send = now;
+}
+
+static void _profile_init(rf_profile_t *prof)
+{
+	memset(prof->mask, 0, sizeof(prof->mask));
+}
+
+static void _profile_set_regs(rf_profile_t *prof, uint8_t reg,
+				const uint8_t *vals, size_t len)
+{
+	uint8_t r;
+
+	assert(reg != RegFifo && reg + len <= RF_REG_CNT);
+
+	for (size_t i = 0; i < len; i++) {
+		r = reg + i;
+		prof->regs[r] = vals[i];
+		prof->mask[r / 8] |= 1 << (r % 8);
+	}
+}
+
+static void _profile_set_reg(rf_profile_t *prof, uint8_t reg, uint8_t val)
+{
+	_profile_set_regs(prof, reg, &val, 1);
+}
+
+/**
+ * Queue PA configuration
+ */
+static int _profile_set_pa(rf_profile_t *prof, uint8_t level, bool pa1_on)
+{
+	uint8_t val = 0;
+	if (pa1_on) {
+		val |= 0x40;
+		if (level > 0x1f) {
+			val |= 0x20;
+			level -= 4;
+		}
+	} else {
+		val |= 0x80;
+	}
+
+	if (level > 0x1f) {
+		return ERR_INVAL;
+	}
+
+	val |= level;
+
+	_profile_set_reg(prof, RegPaLevel, val);
+
+	return ERR_OK;
+}
+
+static int _profile_set_frequency(rf_profile_t *prof, double freq_mhz)
+{
+	double r = (freq_mhz * 1e6) / SX1231_FSTEP;
+	uint32_t reg_freq;
+	uint8_t buf[3];
+
+	// Check range before converting, out of range conversion is undefined
+	if (!(freq_mhz > 0 && r < 0x1000000)) {
+		return ERR_INVAL;
+	}
+	reg_freq = r;
+
+	buf[0] = reg_freq >> 16;
+	buf[1] = reg_freq >> 8;
+	buf[2] = reg_freq;
+	_profile_set_regs(prof, RegFrfMsb, buf, sizeof(buf));
+
+	return ERR_OK;
+}
+
+static int _profile_set_bitrate(rf_profile_t *prof, double data_rate_kbps)
+{
+	double r;
+	uint32_t reg_bitrate;
+	uint8_t buf[2];
+
+	if (!(data_rate_kbps > 0)) {
+		return ERR_INVAL;
+	}
+	r = SX1231_FXOSC / (data_rate_kbps * 1000);
+	if (!(r >= 1 && r < 0x10000)) {
+		return ERR_INVAL;
+	}
+	reg_bitrate = r;
+
+	buf[0] = reg_bitrate >> 8;
+	buf[1] = reg_bitrate;
+	_profile_set_regs(prof, RegBitrateMsb, buf, sizeof(buf));
+
+	return ERR_OK;
+}
+
+static int _profile_set_modulation(rf_profile_t *prof, int modulation)
+{
+	if (modulation == SX1231_MODULATION_OOK) {
+		_profile_set_reg(prof, RegDataModul, 0x08);
+	} else if (modulation == SX1231_MODULATION_FSK) {
+		_profile_set_reg(prof, RegDataModul, 0x00);
+	} else {
+		return ERR_INVAL;
+	}
+
+	return ERR_OK;
+}
+
+static int _profile_set_fdev(rf_profile_t *prof, double fdev_khz)
+{
+	double r = (fdev_khz * 1e3) / SX1231_FSTEP;
+	uint32_t reg_fdev;
+	uint8_t buf[2];
+
+	if (!(r >= 0 && r < 0x4000)) {
+		return ERR_INVAL;
+	}
+	reg_fdev = r;
+
+	buf[0] = reg_fdev >> 8;
+	buf[1] = reg_fdev;
+	_profile_set_regs(prof, RegFdevMsb, buf, sizeof(buf));
+
+	return ERR_OK;
+}
+
+static int _profile_set_framing(rf_profile_t *prof,
+				const rf_framing_t *framing)
+{
+	static const rf_framing_t none = { 0 };
+	uint8_t buf[2];
+	unsigned int i;
+
+	if (framing == NULL) {
+		framing = &none;
+	}
+	if (framing->preamble_len > 0xffff ||
+			framing->sync_len > SX1231_SYNC_SIZE) {
+		return ERR_INVAL;
+	}
+	for (i = 0; i < framing->sync_len; i++) {
+		// Not supported by the sync word generator
+		if (framing->sync[i] == 0x00) {
+			return ERR_INVAL;
+		}
+	}
+
+	buf[0] = framing->preamble_len >> 8;
+	buf[1] = framing->preamble_len;
+	_profile_set_regs(prof, RegPreambleMsb, buf, sizeof(buf));
+
+	if (framing->sync_len != 0) {
+		_profile_set_reg(prof, RegSyncConfig, SYNC_CONFIG_SYNCON |
+					((framing->sync_len - 1) << 3));
+		_profile_set_regs(prof, RegSyncValue, framing->sync,
+					framing->sync_len);
+	} else {
+		_profile_set_reg(prof, RegSyncConfig, 0x18);
+	}
+
+	_profile_set_reg(prof, RegPacketConfig1, framing->manchester ?
+				PACKET_CONFIG1_DCFREE_MANCHESTER :
+				PACKET_CONFIG1_DCFREE_NONE);
+
+	return ERR_OK;
+}
+
+/**
+ * Queue writes for profile registers that differ from the shadow registers
+ *
+ * Every run of consecutive profile registers is diffed separately. If the
+ * bit rate or framing is part of the profile the FIFO threshold is updated
+ * for it.
+ */
+static void _txn_apply_profile(rf_dev_t *dev, spi_txn_t *txn,
+				const rf_profile_t *prof)
+{
+	unsigned int reg = 0;
+	unsigned int end;
+
+	while (reg < RF_REG_CNT) {
+		if (!(prof->mask[reg / 8] & (1 << (reg % 8)))) {
+			reg++;
+			continue;
+		}
+
+		end = reg + 1;
+		while (end < RF_REG_CNT &&
+				(prof->mask[end / 8] & (1 << (end % 8)))) {
+			end++;
+		}
+
+		_txn_write_shadow(dev, txn, reg, &prof->regs[reg], end - reg);
+		reg = end;
+	}
+
+	if ((prof->mask[RegBitrateLsb / 8] & (1 << (RegBitrateLsb % 8))) ||
+			(prof->mask[RegPacketConfig1 / 8] &
+				(1 << (RegPacketConfig1 % 8)))) {
+		// Start TX if FifoNotEmpty
+		_update_byte_time(dev);
+		_txn_write_shadow_reg(dev, txn, RegFifoThresh,
+					0x80 | _choose_fifo_thresh(dev));
+	}
+}
+
+/**
+ * Check if the shadow registers hold all registers of a profile
+ *
+ * Includes the FIFO threshold _txn_apply_profile() would choose for it.
+ */
+static bool _profile_is_applied(rf_dev_t *dev, const rf_profile_t *prof)
+{
+	unsigned int reg;
+
+	for (reg = 0; reg < RF_REG_CNT; reg++) {
+		if ((prof->mask[reg / 8] & (1 << (reg % 8))) &&
+				!_shadow_is(dev, reg, prof->regs[reg])) {
+			return false;
+		}
+	}
+
+	// Bit rate and framing match, so the byte time is the profile's
+	return _shadow_is(dev, RegFifoThresh, 0x80 | _choose_fifo_thresh(dev));
+}
+
+/**
+ * Queue register writes for values that differ from the shadow registers
+ *
+ * Writes the range from the first to the last changed register as a single
+ * burst, including unchanged registers in between. The shadow is updated
+ * immediately, use _shadow_submit() to submit the transaction.
+ *
+ * @param dev		Device handle
+ * @param txn		Transaction to add writes to
+ * @param reg		First register address
+ * @param vals		Register values
+ * @param len		Amount of registers
+ */
+static void _txn_write_shadow(rf_dev_t *dev, spi_txn_t *txn, uint8_t reg,
+				const uint8_t *vals, size_t len)
+{
+	size_t first = len;
+	size_t last = 0;
+	size_t i;
+	uint8_t r;
+
+	assert(reg != RegFifo && reg + len <= RF_REG_CNT);
+
+	for (i = 0; i < len; i++) {
+		r = reg + i;
+		if (!_shadow_is(dev, r, vals[i])) {
+			if (first == len) {
+				first = i;
+			}
+			last = i;
+		}
+	}
+
+	for (i = first; i < len && i <= last; i++) {
+		r = reg + i;
+		spi_txn_write_reg(txn, r, vals[i]);
+		dev->shadow[r] = vals[i];
+		dev->shadow_valid[r / 8] |= 1 << (r % 8);
+	}
+}
+
+static void _txn_write_shadow_reg(rf_dev_t *dev, spi_txn_t *txn, uint8_t reg,
+				uint8_t val)
+{
+	_txn_write_shadow(dev, txn, reg, &val, 1);
+}
+
+/**
+ * Submit transaction containing shadowed writes
+ *
+ * If the transaction fails it is unknown which writes reached the module, so
+ * all shadow registers are invalidated.
+ */
+static int _shadow_submit(rf_dev_t *dev, spi_txn_t *txn)
+{
+	int err;
+
+	err = spi_txn_submit(&dev->spi, txn);
+	if (err != ERR_OK) {
+		memset(dev->shadow_valid, 0, sizeof(dev->shadow_valid));
+	}
+
+	return err;
+}
+
+/**
+ * Check if shadow register is known to have value
+ */
+static bool _shadow_is(rf_dev_t *dev, uint8_t reg, uint8_t val)
+{
+	return (dev->shadow_valid[reg / 8] & (1 << (reg % 8))) &&
+		dev->shadow[reg] == val;
+}
+
+/**
+ * Update byte and header time from shadowed bit rate and framing registers
+ */
+static void _update_byte_time(rf_dev_t *dev)
+{
+	uint64_t chip_time;
+	unsigned int header_len;
+
+	chip_time = SX1231_BYTE_TIME_NS(
+		(dev->shadow[RegBitrateMsb] << 8) | dev->shadow[RegBitrateLsb]);
+
+	header_len = (dev->shadow[RegPreambleMsb] << 8) |
+			dev->shadow[RegPreambleLsb];
+	if (dev->shadow[RegSyncConfig] & SYNC_CONFIG_SYNCON) {
+		header_len += ((dev->shadow[RegSyncConfig] >> 3) & 0x7) + 1;
+	}
+	dev->header_time = header_len * chip_time;
+
+	// Manchester encoding sends every bit as two chips
+	dev->byte_time = chip_time;
+	if ((dev->shadow[RegPacketConfig1] & 0x60) ==
+			PACKET_CONFIG1_DCFREE_MANCHESTER) {
+		dev->byte_time *= 2;
+	}
+}
+
+/**
+ * Check if the module adds framing to the FIFO data
+ */
+static bool _framing_enabled(rf_dev_t *dev)
+{
+	return dev->header_time != 0 ||
+		(dev->shadow[RegPacketConfig1] & 0x60) !=
+			PACKET_CONFIG1_DCFREE_NONE;
+}
+
+/**
+ * Check if registers can be reliably accessed at a SPI clock speed
+ *
+ * Overwrites RegSyncValue.
+ *
+ * @returns	0 if reliable, ERR_SPI_SPEED if not
+ */
+static int _check_spi_speed(rf_dev_t *dev, uint32_t speed_hz)
+{
+	static const uint8_t pattern[SX1231_SYNC_SIZE] = {
+		0x55, 0xaa, 0x0f, 0xf0, 0x33, 0xcc, 0x01, 0x80
+	};
+	int err = ERR_UNSPEC;
+	uint8_t wbuf[SX1231_SYNC_SIZE];
+	uint8_t rbuf[SX1231_SYNC_SIZE];
+	spi_txn_t txn;
+	int round;
+	int i;
+
+	TRY(spi_set_speed(&dev->spi, speed_hz));
+
+	spi_txn_init(&txn);
+	for (round = 0; round < SPI_PROBE_ROUNDS; round++) {
+		// Rotate and invert pattern to exercise all bit positions
+		for (i = 0; i < SX1231_SYNC_SIZE; i++) {
+			wbuf[i] = pattern[(i + round) % SX1231_SYNC_SIZE];
+			if (round & 1) {
+				wbuf[i] ^= 0xff;
+			}
+		}
+
+		spi_txn_write(&txn, RegSyncValue, wbuf, SX1231_SYNC_SIZE);
+		spi_txn_read(&txn, RegSyncValue, rbuf, SX1231_SYNC_SIZE);
+		TRY(spi_txn_submit(&dev->spi, &txn));
+
+		if (memcmp(wbuf, rbuf, SX1231_SYNC_SIZE) != 0) {
+			return ERR_SPI_SPEED;
+		}
+	}
+
+	return ERR_OK;
+fail:
+	return err;
+}
+
+/**
+ * Select first reliable speed from a list of SPI clock speeds
+ */
+static int _probe_spi_speed(rf_dev_t *dev, const uint32_t *speeds, size_t cnt,
+				uint32_t *speed_hz)
+{
+	int err = ERR_UNSPEC;
+	int probe_err = ERR_SPI_SPEED;
+	uint32_t orig_speed = dev->spi.speed_hz;
+	uint8_t orig_sync[SX1231_SYNC_SIZE];
+	size_t i;
+
+	// Current speed is known to work, use it to save the sync word
+	TRY(spi_read_regs(&dev->spi, RegSyncValue, orig_sync, SX1231_SYNC_SIZE));
+
+	for (i = 0; i < cnt && probe_err == ERR_SPI_SPEED; i++) {
+		probe_err = _check_spi_speed(dev, speeds[i]);
+		DBG_PRINTF(DBG_LVL_MID, "SPI clock speed %u Hz: %s\n",
+				speeds[i], probe_err == ERR_OK ? "OK" : "FAILED");
+	}
+
+	if (probe_err == ERR_OK) {
+		*speed_hz = dev->spi.speed_hz;
+	} else if (orig_speed != 0) {
+		TRY(spi_set_speed(&dev->spi, orig_speed));
+	}
+
+	TRY(spi_write_regs(&dev->spi, RegSyncValue, orig_sync, SX1231_SYNC_SIZE));
+
+	return probe_err;
+fail:
+	return err;
+}
+
+/**
+ * Get path of file used to cache the probed SPI speed
+ */
+static void _speed_cache_path(const char *spi_path, char *buf, size_t len)
+{
+	const char *name;
+
+	name = strrchr(spi_path, '/');
+	name = (name == NULL) ? spi_path : name + 1;
+
+	snprintf(buf, len, CACHE_DIR "/sx1231_ods-%s.speed", name);
+}
+
+/**
+ * Load cached SPI speed
+ *
+ * The cache directory may be world writable, so only regular files owned by
+ * the current user are trusted.
+ *
+ * @returns	Cached speed in Hz, or 0 if unavailable
+ */
+static uint32_t _speed_cache_load(const char *spi_path)
+{
+	char path[PATH_MAX];
+	unsigned long speed;
+	struct stat st;
+	FILE *fp;
+	int fd;
+
+	_speed_cache_path(spi_path, path, sizeof(path));
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0) {
+		return 0;
+	}
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+			st.st_uid != geteuid()) {
+		DBG_PRINTF(DBG_LVL_LOW, "Ignoring untrusted SPI speed cache "
+				"%s\n", path);
+		close(fd);
+		return 0;
+	}
+	if ((fp = fdopen(fd, "r")) == NULL) {
+		close(fd);
+		return 0;
+	}
+	if (fscanf(fp, "%lu", &speed) != 1 || speed > UINT32_MAX) {
+		speed = 0;
+	}
+	fclose(fp);
+
+	return speed;
+}
+
+/**
+ * Store SPI speed in cache
+ *
+ * Written to a new temporary file that is renamed into place, so existing
+ * files or symlinks planted in the cache directory are never written to.
+ * Failure is not fatal, the speed will just be probed again next time.
+ */
+static void _speed_cache_store(const char *spi_path, uint32_t speed_hz)
+{
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX + 16];
+	int fd;
+	int ret;
+
+	_speed_cache_path(spi_path, path, sizeof(path));
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path, (long) getpid());
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW |
+			O_CLOEXEC, 0644);
+	if (fd < 0) {
+		DBG_PRINTF(DBG_LVL_LOW, "Unable to write SPI speed cache %s\n", path);
+		return;
+	}
+	ret = dprintf(fd, "%u\n", speed_hz);
+	if (close(fd) != 0 || ret < 0 || rename(tmp_path, path) != 0) {
+		DBG_PRINTF(DBG_LVL_LOW, "Unable to write SPI speed cache %s\n", path);
+		unlink(tmp_path);
+	}
+}
+
+/**
+ * Set SPI clock speed to cached or probed value
+ */
+static int _auto_spi_speed(rf_dev_t *dev, const char *spi_path)
+{
+	int err;
+	uint32_t speed_hz;
+
+	speed_hz = _speed_cache_load(spi_path);
+	if (speed_hz != 0) {
+		// Quick check if cached speed is still reliable
+		err = _probe_spi_speed(dev, &speed_hz, 1, &speed_hz);
+		if (err != ERR_SPI_SPEED) {
+			return err;
+		}
+		DBG_PRINTF(DBG_LVL_LOW, "Cached SPI speed unreliable, probing\n");
+	}
+
+	err = rf_probe_spi_speed(dev, &speed_hz);
+	if (err != ERR_OK) {
+		return err;
+	}
+
+	_speed_cache_store(spi_path, speed_hz);
+
+	return ERR_OK;
+}
+
 static void _dump_status(rf_dev_t *dev)
 {
 	uint8_t buf[2];
 
-	spi_read_regs(dev->fd, RegIrqFlags1, buf, 2);
+	spi_read_regs(&dev->spi, RegIrqFlags1, buf, 2);
 	printf("Interrupt Flags: %.2x %.2x\n", buf[0], buf[1]);
 }
 
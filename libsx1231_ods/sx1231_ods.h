@@ -32,16 +32,240 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/uio.h>
 
 #include "sx1231_ods_debug.h"
 #include "sx1231_ods_error.h"
+#include "spi.h"
+#include "gpio.h"
+#include "bits.h"
 
+#define RF_DIO_CNT 6	/**< Amount of DIO pins on SX1231 */
+
+/**
+ * Wait strategies
+ */
+enum {
+	RF_WAIT_SPIN = 0,	/**< Poll continuously */
+	RF_WAIT_SPIN_SLEEP = 1,	/**< Poll for a short time, then sleep between polls */
+	RF_WAIT_SLEEP = 2,	/**< Sleep till expected time, then as SPIN_SLEEP */
+	RF_WAIT_STRATEGY_CNT
+};
+
+/**
+ * Cost of waiting with a wait strategy
+ */
+typedef struct {
+	unsigned long waits;		/**< Amount of waits */
+	uint64_t wait_time;		/**< Total time spend waiting, in ns */
+	uint64_t cpu_time;		/**< CPU time used while waiting, in ns */
+	unsigned long sleeps;		/**< Amount of sleeps */
+	uint64_t wake_latency_total;	/**< Sum of sleep overshoots, in ns */
+	uint64_t wake_latency_max;	/**< Largest sleep overshoot, in ns */
+} rf_wait_stats_t;
+
+/**
+ * Idle policies
+ */
+enum {
+	RF_IDLE_STDBY = 0,	/**< Standby mode between transmissions */
+	RF_IDLE_FS = 1,		/**< Frequency synthesizer mode, lowest latency */
+	RF_IDLE_SLEEP = 2,	/**< Sleep mode, lowest power */
+	RF_IDLE_ADAPTIVE = 3,	/**< Choose from time between transmissions */
+	RF_IDLE_POLICY_CNT
+};
+
+/**
+ * Running latency statistics
+ */
+typedef struct {
+	unsigned long count;	/**< Amount of samples */
+	double mean;		/**< Mean latency, in ns */
+	double m2;		/**< Sum of squared differences from mean */
+	uint64_t max;		/**< Largest latency, in ns */
+} rf_latency_t;
+
+/**
+ * FIFO threshold tuning state, see rf_get_fifo_tuning()
+ */
 typedef struct {
-	int fd;
+	uint8_t thresh;		/**< FIFO threshold, in bytes */
+	uint8_t chunk;		/**< Refill chunk size, in bytes */
+	unsigned long samples;	/**< Amount of refill latency samples */
+	double latency_mean;	/**< Mean refill latency, in ns */
+	double latency_stddev;	/**< Standard deviation of refill latency, in ns */
+	uint64_t latency_max;	/**< Largest refill latency, in ns */
+} rf_fifo_tuning_t;
+
+#define RF_UNDERRUN_PROB_DEFAULT 1e-3 /**< Default FIFO underrun target */
+
+#define RF_HIST_BUCKETS 24 /**< Amount of buckets in rf_hist_t */
+
+/**
+ * Histogram with logarithmic buckets
+ *
+ * Bucket 0 counts samples below 2 us, bucket i samples of 2^i up to
+ * 2^(i+1) us. The last bucket also counts all longer samples.
+ */
+typedef struct {
+	unsigned long count[RF_HIST_BUCKETS]; /**< Samples per bucket */
+} rf_hist_t;
+
+/**
+ * Performance statistics, see rf_get_stats()
+ */
+typedef struct {
+	unsigned long xfers;	/**< SPI transfers(ioctl's) */
+	unsigned long spi_bytes; /**< Bytes transferred over SPI */
+	unsigned long polls;	/**< Status register reads while waiting */
+	unsigned long refills;	/**< FIFO refills */
+	unsigned int min_headroom; /**< Lowest FIFO level at a refill, in bytes,
+				    UINT_MAX if there were no refills */
+	unsigned long underruns; /**< Detected FIFO underruns */
+	unsigned long sends;	/**< Completed transmissions */
+	uint64_t airtime;	/**< Time spent transmitting, in ns */
+	uint64_t mode_switch_time; /**< Time spent waiting for mode switches,
+				    in ns */
+	rf_hist_t send_time;	/**< Duration of transmissions */
+	rf_hist_t mode_switch;	/**< Duration of mode switches */
+} rf_stats_t;
+
+/**
+ * Statistics counters of a device
+ *
+ * Updated with atomic operations, so a snapshot can be taken from any thread
+ * without waiting for a transmission to finish.
+ */
+typedef struct {
+	atomic_ulong polls;
+	atomic_ulong refills;
+	atomic_uint min_headroom;
+	atomic_ulong underruns;
+	atomic_ulong sends;
+	_Atomic uint64_t airtime;
+	_Atomic uint64_t mode_switch_time;
+	atomic_ulong send_time[RF_HIST_BUCKETS];
+	atomic_ulong mode_switch[RF_HIST_BUCKETS];
+} rf_stats_counters_t;
+
+#define RF_REG_CNT 0x80 /**< Size of register address space */
+
+#define RF_STREAM_BUF_SIZE 256 /**< Size of rf_stream_write() buffer */
+#define RF_ASYNC_QUEUE_LEN 256 /**< Maximum amount of rf_submit() frames */
+
+/**
+ * State of a non-blocking transmission, see rf_tx_begin()
+ */
+typedef struct {
+	int state; /**< Current step of the transmission */
+	bool waking; /**< Waiting for module to leave sleep mode */
+	int idle; /**< Mode to return to after the transmission */
+	const uint8_t *data; /**< Data not yet written to FIFO */
+	size_t len; /**< Length of data */
+	uint64_t start; /**< Time rf_tx_begin() was called */
+	uint64_t tx_start; /**< Predicted start of the transmission */
+	size_t written; /**< Bytes written to FIFO since tx_start */
+	uint64_t due; /**< Time next step is due */
+	uint64_t deadline; /**< Time the polled flag must have changed by */
+	int fd; /**< Timer readable when step is due, -1 if not created */
+} rf_tx_sm_t;
+
+/**
+ * State of a stream, see rf_stream_begin()
+ */
+typedef struct {
+	bool active; /**< Stream begun and not ended */
+	bool tx; /**< Transmitter started */
+	int idle; /**< Mode to return to after the stream */
+	uint64_t start; /**< Time rf_stream_begin() was called */
+	uint64_t expect; /**< Time FIFO is expected to drop below threshold */
+	uint64_t tx_start; /**< Predicted start, for RF_REFILL_PREDICT */
+	size_t written; /**< Bytes written to FIFO since tx_start */
+	unsigned int refills; /**< FIFO refills since tx_start */
+	size_t rd; /**< Read offset in buf */
+	size_t cnt; /**< Amount of bytes in buf */
+	size_t len; /**< Total amount of bytes written to the stream */
+	uint8_t buf[RF_STREAM_BUF_SIZE]; /**< Data not yet written to FIFO */
+} rf_stream_t;
+
+typedef struct {
+	spi_dev_t spi; /**< SPI transport to radio module */
 	uint8_t fifo_thresh; /**< FifoLevel interrupt threshold */
+	uint64_t byte_time; /**< Time to transmit one byte, in ns */
+	uint64_t header_time; /**< Time to transmit preamble and sync word */
+	int refill_mode; /**< FIFO refill mode, see rf_set_refill_mode() */
+	gpio_line_t dio[RF_DIO_CNT]; /**< GPIO lines connected to DIO pins */
+	int wait_strategy; /**< Wait strategy, see rf_set_wait_strategy() */
+	rf_wait_stats_t wait_stats[RF_WAIT_STRATEGY_CNT]; /**< Per strategy */
+	uint64_t flag_mark; /**< Last time a waited for flag was unchanged */
+	rf_latency_t refill_latency; /**< Time from FIFO drop to refill done */
+	double underrun_prob; /**< Target FIFO underrun probability */
+	uint8_t shadow[RF_REG_CNT]; /**< Last known register values */
+	uint8_t shadow_valid[RF_REG_CNT / 8]; /**< Bitmap of known registers */
+	bool auto_modes; /**< Use RegAutoModes, see rf_set_auto_modes() */
+	bool tx_pending; /**< Module might still be transmitting */
+	uint64_t tx_end; /**< Predicted end of pending transmission */
+	int idle_policy; /**< Idle policy, see rf_set_idle_policy() */
+	uint64_t last_send; /**< Start time of last rf_send() */
+	uint64_t send_interval; /**< Average time between rf_send() calls */
+	rf_latency_t tx_start_latency[RF_IDLE_POLICY_CNT]; /**< Per policy */
+	rf_latency_t trigger_latency; /**< Duration of TX trigger transfer */
+	int64_t start_error; /**< Start error of last rf_send_at(), in ns */
+	rf_latency_t start_error_abs; /**< Absolute rf_send_at() start error */
+	rf_stream_t stream; /**< Stream state */
+	rf_tx_sm_t tx_sm; /**< Non-blocking transmission state */
+	uint64_t last_tx_start; /**< Time last transmission started */
+	_Atomic(struct rf_async *) async; /**< TX thread, see rf_async_start() */
+	pthread_mutex_t lock; /**< Protects lock state below and statistics */
+	pthread_cond_t lock_cond; /**< Signalled when lock_serving changes */
+	unsigned long lock_next; /**< Next ticket to hand out */
+	unsigned long lock_serving; /**< Ticket currently holding the lock */
+	pthread_t lock_owner; /**< Thread holding the lock */
+	unsigned int lock_depth; /**< Nesting depth of lock_owner, 0 if free */
+	bool flock_held; /**< Holding the inter-process lock on the device */
+	uint64_t *lock_gen_shared; /**< flock generation, shared by processes */
+	uint64_t lock_gen; /**< lock_gen_shared after our last flock */
+	uint64_t lock_wait; /**< Lock wait time of last operation, in ns */
+	rf_latency_t lock_wait_stats; /**< Lock wait time statistics */
+	rf_stats_counters_t stats; /**< Statistics, see rf_get_stats() */
 } rf_dev_t;
 
-int rf_open(rf_dev_t *dev, const char *spi_path);
+/**
+ * Special SPI clock speed values for rf_open()
+ */
+#define RF_SPI_SPEED_DEFAULT	0		/**< Keep spidev default speed */
+#define RF_SPI_SPEED_AUTO	UINT32_MAX	/**< Use probed speed */
+
+/**
+ * Open radio module
+ *
+ * @param dev		Device handle to initialize
+ * @param spi_path	Path to SPI device, or 'sim' for a simulated radio
+ * @param spi_speed_hz	SPI clock speed in Hz, RF_SPI_SPEED_DEFAULT to keep
+ *			the driver default, or RF_SPI_SPEED_AUTO to use the
+ *			speed found by rf_probe_spi_speed(). The probed speed
+ *			is cached for later opens of the same device.
+ *
+ * @returns	0 on success
+ */
+int rf_open(rf_dev_t *dev, const char *spi_path, uint32_t spi_speed_hz);
+
+/**
+ * Find the highest reliable SPI clock speed
+ *
+ * Test patterns are written to, and read back from, RegSyncValue at
+ * decreasing clock speeds. The first speed at which all patterns read back
+ * correctly is selected. The original RegSyncValue contents are restored
+ * afterwards.
+ *
+ * @param dev		Device handle
+ * @param speed_hz	Pointer to location to store selected speed
+ *
+ * @returns	0 on success, ERR_SPI_SPEED if no reliable speed was found
+ */
+int rf_probe_spi_speed(rf_dev_t *dev, uint32_t *speed_hz);
 
 void rf_close(rf_dev_t *dev);
 
@@ -54,8 +278,635 @@ int rf_config(rf_dev_t *dev,
 		float freq_mhz, float fdev_khz,
 		int modulation, double data_rate_kbps);
 
+/**
+ * Precompiled radio configuration
+ *
+ * Register image of a configuration, with a bitmap of the registers that
+ * are part of the configuration. Profiles don't depend on a device, any
+ * amount of them can be kept and applied to any device.
+ */
+typedef struct {
+	uint8_t regs[RF_REG_CNT]; /**< Register values */
+	uint8_t mask[RF_REG_CNT / 8]; /**< Bitmap of registers in profile */
+} rf_profile_t;
+
+/**
+ * Compile profile from rf_config() parameters
+ *
+ * @param prof		Profile to initialize
+ * @param freq_mhz	Carrier frequency, in MHz
+ * @param fdev_khz	FSK frequency deviation, in kHz
+ * @param modulation	SX1231_MODULATION_FSK or SX1231_MODULATION_OOK
+ * @param data_rate_kbps	Bit rate, in kbit/s
+ *
+ * @returns	0 on success
+ */
+int rf_profile_compile(rf_profile_t *prof,
+		float freq_mhz, float fdev_khz,
+		int modulation, double data_rate_kbps);
+
+/**
+ * Set power amplifier configuration of profile
+ *
+ * @param prof		Profile compiled with rf_profile_compile()
+ * @param level		Output power level, see rf_set_pa()
+ * @param pa1_on	Use PA1 instead of PA0
+ *
+ * @returns	0 on success
+ */
+int rf_profile_set_pa(rf_profile_t *prof, uint8_t level, bool pa1_on);
+
+/**
+ * Maximum length of sync word generated by the module
+ */
+#define RF_SYNC_MAX_LEN 8
+
+/**
+ * Packet framing generated by the module, see rf_set_framing()
+ */
+typedef struct {
+	unsigned int preamble_len; /**< Preamble length in bytes, 0 for none */
+	uint8_t sync[RF_SYNC_MAX_LEN]; /**< Sync word, sent MSB first */
+	unsigned int sync_len;	/**< Length of sync word, 0 for none */
+	bool manchester;	/**< Manchester encode the data */
+} rf_framing_t;
+
+/**
+ * Set packet framing of profile
+ *
+ * @param prof		Profile compiled with rf_profile_compile()
+ * @param framing	Framing to use, see rf_set_framing()
+ *
+ * @returns	0 on success
+ */
+int rf_profile_set_framing(rf_profile_t *prof, const rf_framing_t *framing);
+
+/**
+ * Apply profile to device
+ *
+ * Only registers that differ from the current device configuration are
+ * written, in as few bursts as possible, in a single SPI transaction.
+ * Applying the already active profile doesn't access the device at all.
+ * Must not be called during transmission.
+ *
+ * @param dev		Device handle, configured with rf_config()
+ * @param prof		Profile to apply
+ *
+ * @returns	0 on success
+ */
+int rf_apply_profile(rf_dev_t *dev, const rf_profile_t *prof);
+
 int rf_set_pa(rf_dev_t *dev, uint8_t level, bool pa1_on);
 
+/**
+ * Set carrier frequency
+ *
+ * Like the other setters below, only registers that differ from the values
+ * last written are transferred.
+ *
+ * @param dev		Device handle
+ * @param freq_mhz	Carrier frequency, in MHz
+ *
+ * @returns	0 on success
+ */
+int rf_set_frequency(rf_dev_t *dev, double freq_mhz);
+
+/**
+ * Set bit rate
+ *
+ * @param dev		Device handle
+ * @param data_rate_kbps	Bit rate, in kbit/s
+ *
+ * @returns	0 on success
+ */
+int rf_set_bitrate(rf_dev_t *dev, double data_rate_kbps);
+
+/**
+ * Set modulation type
+ *
+ * @param dev		Device handle
+ * @param modulation	SX1231_MODULATION_FSK or SX1231_MODULATION_OOK
+ *
+ * @returns	0 on success
+ */
+int rf_set_modulation(rf_dev_t *dev, int modulation);
+
+/**
+ * Set FSK frequency deviation
+ *
+ * @param dev		Device handle
+ * @param fdev_khz	Frequency deviation, in kHz
+ *
+ * @returns	0 on success
+ */
+int rf_set_fdev(rf_dev_t *dev, double fdev_khz);
+
+/**
+ * Let the module generate preamble, sync word and Manchester encoding
+ *
+ * Every transmission then starts with 'preamble_len' bytes of alternating
+ * ones and zeros, followed by the sync word. Both are sent at the configured
+ * bit rate. With Manchester encoding every data bit is sent as two chips at
+ * the bit rate: a one as '10' and a zero as '01'. So only the data itself is
+ * written to the FIFO, and data bytes take twice as long to send.
+ *
+ * As the module sends the preamble and sync word only once per transmission,
+ * rf_send_train() sends every repeat as a separate transmission when framing
+ * is enabled. Streams and non-blocking transmissions are framed as a whole.
+ *
+ * rf_config() disables all framing.
+ *
+ * @param dev		Device handle
+ * @param framing	Framing to use, or NULL to disable framing. Sync word
+ *			bytes must not be 0x00.
+ *
+ * @returns	0 on success
+ */
+int rf_set_framing(rf_dev_t *dev, const rf_framing_t *framing);
+
+/**
+ * FIFO refill modes
+ */
+enum {
+	RF_REFILL_POLL = 0,	/**< Poll FIFO level before every refill */
+	RF_REFILL_PREDICT = 1,	/**< Predict FIFO level from bit rate */
+};
+
+/**
+ * Select how rf_send() and streams decide when to refill the FIFO
+ *
+ * RF_REFILL_POLL reads the FifoLevel flag until the FIFO has drained below
+ * the threshold. RF_REFILL_PREDICT calculates the amount of drained bytes
+ * from the bit rate and CLOCK_MONOTONIC, and only occasionally reads the FIFO
+ * level to correct for drift. This greatly reduces the amount of SPI
+ * transfers during a transmission.
+ *
+ * @param dev		Device handle
+ * @param mode		RF_REFILL_POLL or RF_REFILL_PREDICT
+ *
+ * @returns	0 on success
+ */
+int rf_set_refill_mode(rf_dev_t *dev, int mode);
+
+/**
+ * Let the module switch modes for transmission by itself
+ *
+ * When enabled RegAutoModes is programmed to enter TX mode when data is
+ * written to the FIFO, and to return to standby mode on PacketSent. This
+ * removes the mode switches from rf_send(). Also rf_send() returns as soon as
+ * all data is written to the FIFO, without waiting for PacketSent. Waiting
+ * for the transmission to finish is deferred to the next call that uses the
+ * module, or can be done explicitly with rf_flush().
+ *
+ * @param dev		Device handle
+ * @param enable	Enable or disable automatic mode switching
+ *
+ * @returns	0 on success
+ */
+int rf_set_auto_modes(rf_dev_t *dev, bool enable);
+
+/**
+ * Wait till the module finished transmitting data passed to rf_send()
+ *
+ * Only needed with rf_set_auto_modes(), else rf_send() already waits.
+ *
+ * @param dev		Device handle
+ *
+ * @returns	0 on success
+ */
+int rf_flush(rf_dev_t *dev);
+
+/**
+ * Select mode the module is kept in between transmissions
+ *
+ * Keeping the module in FS mode saves the synthesizer startup on every
+ * transmission, but uses most power. Sleep mode uses least power, but adds
+ * the oscillator startup and an extra mode switch. RF_IDLE_ADAPTIVE uses FS
+ * mode if rf_send() is called more often than every 100 ms, standby mode if
+ * more often than every 10 s, and sleep mode otherwise.
+ *
+ * With rf_set_auto_modes() the module returns to standby instead of sleep
+ * mode, it is put to sleep by rf_flush().
+ *
+ * @param dev		Device handle
+ * @param policy	RF_IDLE_STDBY, RF_IDLE_FS, RF_IDLE_SLEEP or
+ *			RF_IDLE_ADAPTIVE
+ *
+ * @returns	0 on success
+ */
+int rf_set_idle_policy(rf_dev_t *dev, int policy);
+
+/**
+ * Get TX start latency of an idle policy
+ *
+ * The latency is the time from calling rf_send() till the transmitter is
+ * ready. With rf_set_auto_modes() the transmitter ready time is calculated
+ * from the datasheet timing instead of measured.
+ *
+ * @param dev		Device handle
+ * @param policy	Idle policy to get statistics for
+ * @param stats		Pointer to location to store statistics
+ *
+ * @returns	0 on success
+ */
+int rf_get_tx_start_latency(rf_dev_t *dev, int policy, rf_latency_t *stats);
+
+/**
+ * Standard deviation of latency statistics, in ns
+ */
+double rf_latency_stddev(const rf_latency_t *stats);
+
+/**
+ * Select how to wait for the module while polling
+ *
+ * RF_WAIT_SPIN polls as fast as possible, giving the lowest latency at the
+ * cost of a fully used CPU core. RF_WAIT_SPIN_SLEEP polls for a short time
+ * and then sleeps for half a byte time between polls. RF_WAIT_SLEEP sleeps
+ * with clock_nanosleep() till the time the FIFO is calculated to have
+ * drained, and wakes up early to compensate for the measured wake-up
+ * latency.
+ *
+ * @param dev		Device handle
+ * @param strategy	RF_WAIT_SPIN, RF_WAIT_SPIN_SLEEP or RF_WAIT_SLEEP
+ *
+ * @returns	0 on success
+ */
+int rf_set_wait_strategy(rf_dev_t *dev, int strategy);
+
+/**
+ * Get CPU cost and wake-up latency of a wait strategy
+ *
+ * @param dev		Device handle
+ * @param strategy	Wait strategy to get statistics for
+ * @param stats		Pointer to location to store statistics
+ *
+ * @returns	0 on success
+ */
+int rf_get_wait_stats(rf_dev_t *dev, int strategy, rf_wait_stats_t *stats);
+
+/**
+ * Set target FIFO underrun probability
+ *
+ * The time between the FIFO level dropping to the threshold and the refill
+ * completing is measured during rf_send(). After every packet the FIFO
+ * threshold, and with it the refill chunk size, is chosen so that the
+ * probability of this latency exceeding the time to send the bytes left in
+ * the FIFO stays below the target.
+ *
+ * @param dev		Device handle
+ * @param prob		Target underrun probability per refill, or 0 to
+ *			disable tuning. Defaults to RF_UNDERRUN_PROB_DEFAULT.
+ *
+ * @returns	0 on success
+ */
+int rf_set_underrun_target(rf_dev_t *dev, double prob);
+
+/**
+ * Get current FIFO threshold, refill chunk size and measured refill latency
+ *
+ * @param dev		Device handle
+ * @param tuning	Pointer to location to store tuning state
+ */
+void rf_get_fifo_tuning(rf_dev_t *dev, rf_fifo_tuning_t *tuning);
+
+/**
+ * Get snapshot of performance statistics
+ *
+ * Counts everything since rf_open(). Can be called from any thread, also
+ * while another thread is transmitting. The counters are read one by one, so
+ * the snapshot isn't necessarily consistent between counters.
+ *
+ * @param dev		Device handle
+ * @param stats		Pointer to location to store statistics
+ */
+void rf_get_stats(rf_dev_t *dev, rf_stats_t *stats);
+
+/**
+ * Record SPI transfers and transmit events in a binary trace ring
+ *
+ * The ring is a memory mapped file, so it survives a crash of the process.
+ * Print it with sx1231_trace. While tracing, SPI transfers are no longer
+ * printed at the highest debug level.
+ *
+ * @param dev		Device handle
+ * @param path		Path of the trace file, created if it doesn't exist. An
+ *			existing file must be empty or a trace file.
+ * @param records	Amount of records in the ring, 0 for the default
+ *
+ * @returns	0 on success, ERR_NOT_SUPPORTED if built without WITH_TRACE,
+ *		ERR_TRACE if the file can't be used
+ */
+int rf_trace_open(rf_dev_t *dev, const char *path, size_t records);
+
+/**
+ * DIO pins used for interrupts
+ *
+ * rf_config() maps the interrupt sources to the pins as listed.
+ */
+enum {
+	RF_DIO_PACKETSENT = 0,	/**< DIO0: PacketSent */
+	RF_DIO_FIFOLEVEL = 1,	/**< DIO1: FifoLevel */
+	RF_DIO_MODEREADY = 5,	/**< DIO5: ModeReady */
+};
+
+/**
+ * Use GPIO line events to wait for a DIO pin
+ *
+ * Once attached, waiting for the interrupt source mapped to the pin is done
+ * by waiting for GPIO line events, instead of polling the interrupt flags
+ * over SPI.
+ *
+ * If chip_path is 'sim' and the device is a simulated radio, a simulated DIO
+ * pin is used and offset is ignored.
+ *
+ * @param dev		Device handle
+ * @param dio		DIO pin number, RF_DIO_*
+ * @param chip_path	Path to GPIO chip device, eg. /dev/gpiochip0
+ * @param offset	Line offset within the GPIO chip
+ *
+ * @returns	0 on success
+ */
+int rf_attach_dio(rf_dev_t *dev, int dio, const char *chip_path,
+			unsigned int offset);
+
 int rf_send(rf_dev_t *dev, const uint8_t *data, size_t len);
 
+/**
+ * Send data gathered from multiple buffers
+ *
+ * The buffers are sent back to back, as if they were a single buffer. The
+ * FIFO is filled directly from the buffers, so eg. a preamble can be kept in
+ * a constant buffer separate from the payload.
+ *
+ * @param dev		Device handle
+ * @param iov		Buffers to send
+ * @param iovcnt	Amount of buffers
+ *
+ * @returns	0 on success
+ */
+int rf_sendv(rf_dev_t *dev, const struct iovec *iov, int iovcnt);
+
+/**
+ * Send a frame with a length in bits
+ *
+ * The FIFO only takes whole bytes, so the last byte is padded with zeros.
+ * Frames can be build with a bits_builder_t.
+ *
+ * @param dev		Device handle
+ * @param data		Data to send, MSB of first byte is sent first
+ * @param bits		Length of data, in bits
+ *
+ * @returns	0 on success
+ */
+int rf_send_bits(rf_dev_t *dev, const uint8_t *data, size_t bits);
+
+/**
+ * Frame train entry, see rf_send_train()
+ */
+typedef struct {
+	const struct iovec *iov; /**< Segments of frame data */
+	int iovcnt;		/**< Amount of segments */
+	unsigned int repeat;	/**< Amount of times to send frame */
+	unsigned int gap_us;	/**< Silence after every repeat, in us */
+} rf_train_entry_t;
+
+/**
+ * Send a train of repeated frames in a single transmission
+ *
+ * Every entry's frame is sent 'repeat' times, followed by 'gap_us' of
+ * silence. The gaps are sent as zero bits, rounded to the nearest bit time,
+ * so the spacing doesn't depend on scheduling. The gap after the last frame
+ * of the train is not sent.
+ *
+ * With framing enabled, see rf_set_framing(), every frame is a separate
+ * transmission instead. Each starts 'gap_us' after the previous frame
+ * ended, as with rf_send_at().
+ *
+ * @param dev		Device handle
+ * @param entries	Train entries
+ * @param cnt		Amount of train entries
+ *
+ * @returns	0 on success
+ */
+int rf_send_train(rf_dev_t *dev, const rf_train_entry_t *entries, size_t cnt);
+
+/**
+ * Begin streaming transmission
+ *
+ * Data of a stream is pushed with rf_stream_write() as it is produced, and
+ * sent as one continuous transmission. Only a small buffer is used, so
+ * streams can be of any length. The transmitter is started once there is
+ * enough data to fill the FIFO, or on rf_stream_end().
+ *
+ * No other rf_send functions may be used while a stream is active.
+ *
+ * @param dev	Device handle
+ *
+ * @returns	0 on success
+ */
+int rf_stream_begin(rf_dev_t *dev);
+
+/**
+ * Push data to stream
+ *
+ * Returns as soon as all data is buffered, refilling the FIFO if it has
+ * space. So the time between calls should be less than the time to send the
+ * FIFO threshold level. If the FIFO ran empty the stream is ended and
+ * ERR_RFM_TX_OUT_OF_SYNC is returned. The stream is also ended on any other
+ * error.
+ *
+ * @param dev	Device handle
+ * @param data	Data to send
+ * @param len	Length of data
+ *
+ * @returns	0 on success
+ */
+int rf_stream_write(rf_dev_t *dev, const uint8_t *data, size_t len);
+
+/**
+ * End stream
+ *
+ * Sends all buffered data and waits till the transmission is done.
+ *
+ * @param dev	Device handle
+ *
+ * @returns	0 on success, ERR_RFM_TX_OUT_OF_SYNC if the FIFO ran empty
+ */
+int rf_stream_end(rf_dev_t *dev);
+
+/**
+ * Abort stream
+ *
+ * Stops the transmitter and drops all data that is buffered or still in the
+ * FIFO. Data already sent can't be taken back, so a partial frame may have
+ * gone on air.
+ *
+ * @param dev	Device handle
+ *
+ * @returns	0 on success, ERR_INVAL if no stream is active
+ */
+int rf_stream_abort(rf_dev_t *dev);
+
+/**
+ * Begin non-blocking transmission
+ *
+ * Instead of blocking till the transmission is done, the transmission is
+ * driven by calling rf_tx_step() whenever the file descriptor returned by
+ * rf_tx_fd() becomes readable. This allows multiplexing multiple radios, and
+ * other I/O, in a single thread with poll() or epoll.
+ *
+ * The FIFO level is polled at the predicted time, independent of the refill
+ * mode. No other rf_send functions may be used till the transmission is done.
+ *
+ * @param dev	Device handle
+ * @param data	Data to send, must stay valid till the transmission is done
+ * @param len	Length of data
+ *
+ * @returns	0 on success
+ */
+int rf_tx_begin(rf_dev_t *dev, const uint8_t *data, size_t len);
+
+/**
+ * Advance non-blocking transmission
+ *
+ * Performs the next step of the transmission if it is due. Calling it early
+ * is harmless. On error the transmission is aborted.
+ *
+ * @param dev	Device handle
+ * @param done	Returns true once the transmission is done
+ *
+ * @returns	0 on success
+ */
+int rf_tx_step(rf_dev_t *dev, bool *done);
+
+/**
+ * Get file descriptor to wait on for non-blocking transmissions
+ *
+ * The descriptor is a timerfd that becomes readable when rf_tx_step() must be
+ * called. It stays the same for the lifetime of the device handle.
+ *
+ * @param dev	Device handle
+ *
+ * @returns	File descriptor, or -1 on error with errno set
+ */
+int rf_tx_fd(rf_dev_t *dev);
+
+/**
+ * Result of an asynchronous transmission, see rf_submit()
+ */
+typedef struct {
+	int err; /**< Error code returned by rf_send() */
+	uint64_t submitted; /**< Time rf_submit() was called */
+	uint64_t dequeued; /**< Time TX thread took frame from queue */
+	uint64_t tx_start; /**< Time transmission started */
+	uint64_t tx_end; /**< Time transmission ended, or is predicted to */
+} rf_tx_result_t;
+
+/**
+ * Completion callback of rf_submit()
+ *
+ * Called from the TX thread. Must not call any other function on the device
+ * handle, except rf_submit().
+ *
+ * @param ctx	Context passed to rf_submit()
+ * @param res	Result of the transmission, times are CLOCK_MONOTONIC in ns
+ */
+typedef void (*rf_tx_cb_t)(void *ctx, const rf_tx_result_t *res);
+
+/**
+ * Start TX thread for asynchronous transmissions
+ *
+ * After this only rf_submit() and rf_async_stop() may be called on the device
+ * handle, till rf_async_stop() returns.
+ *
+ * @param dev	Device handle
+ *
+ * @returns	0 on success
+ */
+int rf_async_start(rf_dev_t *dev);
+
+/**
+ * Stop TX thread
+ *
+ * Waits till all queued frames are sent. Other threads must have stopped
+ * calling rf_submit() before this is called, as the queue is freed. Frames
+ * submitted from a callback while stopping are refused with ERR_INVAL.
+ *
+ * @param dev	Device handle
+ *
+ * @returns	0 on success
+ */
+int rf_async_stop(rf_dev_t *dev);
+
+/**
+ * Queue frame for transmission by the TX thread
+ *
+ * Returns immediately. Frames are sent in order, each as with rf_send(). The
+ * data must stay valid till the callback is called. May be called from any
+ * thread, including from the callback. Frames submitted concurrently by
+ * different threads are sent in the order their slots were claimed.
+ *
+ * @param dev	Device handle
+ * @param data	Data to send
+ * @param len	Length of data
+ * @param cb	Callback called after the frame is sent, may be NULL
+ * @param ctx	Context passed to callback
+ *
+ * @returns	0 on success, ERR_BUSY if RF_ASYNC_QUEUE_LEN frames are queued
+ */
+int rf_submit(rf_dev_t *dev, const uint8_t *data, size_t len, rf_tx_cb_t cb,
+		void *ctx);
+
+/**
+ * Send data, starting transmission at a given time
+ *
+ * The FIFO is filled and the module is put in FS mode ahead of time, so on
+ * the deadline only the transmitter has to start. The mode switch is
+ * triggered early by the transmitter startup time, using a sleep followed by
+ * a short busy wait. With automatic modes the FIFO write triggers the
+ * transmission, so the FIFO can't be filled ahead of time. The module then
+ * returns to FS after the transmission, the idle mode is entered by the next
+ * call that waits for the transmission, eg. rf_flush().
+ *
+ * If the deadline is in the past the data is sent immediately. The achieved
+ * start error is available from rf_get_start_error().
+ *
+ * @param dev		Device handle
+ * @param data		Data to send
+ * @param len		Length of data
+ * @param deadline	CLOCK_MONOTONIC time to start transmitting at, in ns
+ *
+ * @returns	0 on success
+ */
+int rf_send_at(rf_dev_t *dev, const uint8_t *data, size_t len,
+		uint64_t deadline);
+
+/**
+ * Get start error of scheduled transmissions
+ *
+ * The start error is the estimated time the first bit was sent minus the
+ * deadline passed to rf_send_at().
+ *
+ * @param dev	Device handle
+ * @param last	Returns error of last rf_send_at() in ns, may be NULL
+ * @param stats	Returns statistics of the absolute error, may be NULL
+ */
+void rf_get_start_error(rf_dev_t *dev, int64_t *last, rf_latency_t *stats);
+
+/**
+ * Get time spent waiting for exclusive access to the module
+ *
+ * Every operation accessing the module, like rf_send(), first waits till
+ * earlier callers from other threads are done, in the order they arrived.
+ * Then it takes an flock() on the SPI device, to serialize with other
+ * processes. After taking the flock, configuration registers changed by
+ * another process are restored, and a transmission of another process using
+ * automatic modes is waited for.
+ *
+ * @param dev	Device handle
+ * @param last	Returns wait time of last operation in ns, may be NULL
+ * @param stats	Returns wait time statistics, may be NULL
+ */
+void rf_get_lock_wait(rf_dev_t *dev, uint64_t *last, rf_latency_t *stats);
+
 #endif // __SX1231_H__
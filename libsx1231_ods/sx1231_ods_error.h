@@ -77,6 +77,7 @@
 #define ERR_CLASS_GENERIC	0x0000
 #define ERR_CLASS_SPI		0x0001
 #define ERR_CLASS_RFM		0x0002
+#define ERR_CLASS_GPIO		0x0003
 
 
 /************************* Error Codes **************************************/
@@ -86,13 +87,25 @@
 #define ERR_UNSPEC		E(ERR_CLASS_GENERIC, 0x0001, 0)
 #define ERR_INVAL		E(ERR_CLASS_GENERIC, 0x0002, 0)
 #define ERR_RANGE		E(ERR_CLASS_GENERIC, 0x0003, 0)
+#define ERR_BUSY		E(ERR_CLASS_GENERIC, 0x0004, 0)
+#define ERR_THREAD		E(ERR_CLASS_GENERIC, 0x0005, ERR_FLAG_ERRNO_SET)
+#define ERR_TIMER		E(ERR_CLASS_GENERIC, 0x0006, ERR_FLAG_ERRNO_SET)
+#define ERR_LOCK		E(ERR_CLASS_GENERIC, 0x0007, ERR_FLAG_ERRNO_SET)
+#define ERR_TRACE		E(ERR_CLASS_GENERIC, 0x0008, ERR_FLAG_ERRNO_SET)
+#define ERR_NOT_SUPPORTED	E(ERR_CLASS_GENERIC, 0x0009, 0)
 
 // SPI errors
 #define ERR_SPI_OPEN_DEV	E(ERR_CLASS_SPI, 0x0001, ERR_FLAG_ERRNO_SET)
 #define ERR_SPI_IOCTL		E(ERR_CLASS_SPI, 0x0002, ERR_FLAG_ERRNO_SET)
+#define ERR_SPI_SPEED		E(ERR_CLASS_SPI, 0x0003, 0)
 
 // Class RF
 #define ERR_RFM_CHIP_VERSION	E(ERR_CLASS_RFM, 0x0001, 0)
 #define ERR_RFM_TX_OUT_OF_SYNC	E(ERR_CLASS_RFM, 0x0002, 0)
+#define ERR_RFM_TIMEOUT		E(ERR_CLASS_RFM, 0x0003, 0)
+
+// GPIO errors
+#define ERR_GPIO_OPEN_DEV	E(ERR_CLASS_GPIO, 0x0001, ERR_FLAG_ERRNO_SET)
+#define ERR_GPIO_IOCTL		E(ERR_CLASS_GPIO, 0x0002, ERR_FLAG_ERRNO_SET)
 
 #endif // __ERROR_H__
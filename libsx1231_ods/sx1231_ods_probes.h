@@ -0,0 +1,64 @@
+/**
+ * sx1231_ods_probes.h - USDT static tracepoints
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __SX1231_ODS_PROBES_H__
+#define __SX1231_ODS_PROBES_H__
+
+/*
+ * Static tracepoints for perf/bpftrace, under the 'sx1231_ods' provider.
+ * A probe is a single nop until a tracer attaches to it. Without sys/sdt.h
+ * the probes are compiled out.
+ *
+ * Probe arguments are only expressions that are evaluated anyway, so no
+ * timestamps are taken just for a probe. Use the timestamp of the tracer
+ * (e.g. bpftrace 'nsecs') where a probe has no time argument.
+ */
+#include "config.h"
+
+#ifdef HAVE_SYS_SDT_H
+# include <sys/sdt.h>
+
+# define RF_PROBE0(name) \
+	DTRACE_PROBE(sx1231_ods, name)
+# define RF_PROBE1(name, a1) \
+	DTRACE_PROBE1(sx1231_ods, name, a1)
+# define RF_PROBE2(name, a1, a2) \
+	DTRACE_PROBE2(sx1231_ods, name, a1, a2)
+# define RF_PROBE3(name, a1, a2, a3) \
+	DTRACE_PROBE3(sx1231_ods, name, a1, a2, a3)
+# define RF_PROBE4(name, a1, a2, a3, a4) \
+	DTRACE_PROBE4(sx1231_ods, name, a1, a2, a3, a4)
+#else
+# define RF_PROBE0(name) do { } while (0)
+# define RF_PROBE1(name, a1) do { } while (0)
+# define RF_PROBE2(name, a1, a2) do { } while (0)
+# define RF_PROBE3(name, a1, a2, a3) do { } while (0)
+# define RF_PROBE4(name, a1, a2, a3, a4) do { } while (0)
+#endif
+
+#endif // __SX1231_ODS_PROBES_H__
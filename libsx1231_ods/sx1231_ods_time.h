@@ -0,0 +1,84 @@
+/**
+ * sx1231_ods_time.h - Monotonic time helper functions
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __SX1231_ODS_TIME_H__
+#define __SX1231_ODS_TIME_H__
+
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#define NSEC_PER_USEC	1000ULL
+#define NSEC_PER_MSEC	1000000ULL
+#define NSEC_PER_SEC	1000000000ULL
+
+/**
+ * Convert timespec to nanoseconds
+ */
+static inline uint64_t time_ts_to_ns(const struct timespec *ts)
+{
+	return (uint64_t) ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+/**
+ * Convert nanoseconds to timespec
+ */
+static inline void time_ns_to_ts(uint64_t ns, struct timespec *ts)
+{
+	ts->tv_sec = ns / NSEC_PER_SEC;
+	ts->tv_nsec = ns % NSEC_PER_SEC;
+}
+
+/**
+ * Get current CLOCK_MONOTONIC time in nanoseconds
+ */
+static inline uint64_t time_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return time_ts_to_ns(&ts);
+}
+
+/**
+ * Sleep until an absolute CLOCK_MONOTONIC time
+ *
+ * @param deadline	Time in nanoseconds to sleep till
+ */
+static inline void time_sleep_until_ns(uint64_t deadline)
+{
+	struct timespec ts;
+
+	time_ns_to_ts(deadline, &ts);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+		// Interrupted by signal, sleep remaining time
+	}
+}
+
+#endif // __SX1231_ODS_TIME_H__
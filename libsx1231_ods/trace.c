@@ -0,0 +1,190 @@
+/**
+ * trace.c - Binary trace ring buffer
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#include "trace.h"
+#include "sx1231_ods_error.h"
+#include "sx1231_ods_debug.h"
+#include "sx1231_ods_time.h"
+
+_Static_assert(sizeof(trace_hdr_t) == 64, "trace header must be 64 bytes");
+_Static_assert(sizeof(trace_rec_t) == 64, "trace record must be 64 bytes");
+
+static bool _trace_hdr_valid(const trace_hdr_t *hdr, size_t rec_cnt);
+
+int trace_open(trace_t *trace, const char *path, size_t rec_cnt)
+{
+	int err = ERR_UNSPEC;
+	int fd;
+	bool created = true;
+	size_t cnt = 1;
+	size_t map_len;
+	struct stat st;
+	trace_hdr_t old;
+	trace_hdr_t *hdr = MAP_FAILED;
+
+	if (rec_cnt == 0 || rec_cnt > UINT32_MAX / 2) {
+		return ERR_INVAL;
+	}
+	while (cnt < rec_cnt) {
+		cnt <<= 1;
+	}
+	map_len = sizeof(trace_hdr_t) + cnt * sizeof(trace_rec_t);
+
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+			0644);
+	if (fd < 0 && errno == EEXIST) {
+		created = false;
+		fd = open(path, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+	}
+	if (fd < 0) {
+		return ERR_TRACE;
+	}
+
+	// Serialize initialization with other processes opening the file
+	if (flock(fd, LOCK_EX) != 0 || fstat(fd, &st) != 0) {
+		SAVE_ERRNO(close(fd));
+		return ERR_TRACE;
+	}
+
+	// Never clobber a file that isn't a trace ring
+	if (!created && st.st_size != 0) {
+		if (!S_ISREG(st.st_mode) ||
+				pread(fd, &old, sizeof(old), 0) != sizeof(old) ||
+				old.magic != TRACE_MAGIC) {
+			DBG_PRINTF(DBG_LVL_LOW, "%s is not a trace file\n", path);
+			errno = EEXIST;
+			err = ERR_TRACE;
+			goto fail;
+		}
+	}
+
+	if ((size_t) st.st_size != map_len) {
+		if (ftruncate(fd, 0) != 0 || ftruncate(fd, map_len) != 0) {
+			err = ERR_TRACE;
+			goto fail;
+		}
+	}
+
+	hdr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED) {
+		err = ERR_TRACE;
+		goto fail;
+	}
+
+	if (! _trace_hdr_valid(hdr, cnt)) {
+		DBG_PRINTF(DBG_LVL_MID, "Initializing trace file %s\n", path);
+		memset(hdr, 0, map_len);
+		hdr->version = TRACE_VERSION;
+		hdr->rec_size = sizeof(trace_rec_t);
+		hdr->rec_cnt = cnt;
+		atomic_store(&hdr->head, 0);
+		// Magic last, a partially initialized file is not valid
+		atomic_thread_fence(memory_order_release);
+		hdr->magic = TRACE_MAGIC;
+	}
+
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	trace_close(trace);
+	trace->hdr = hdr;
+	trace->recs = (trace_rec_t *) (hdr + 1);
+	trace->map_len = map_len;
+
+	return ERR_OK;
+fail:
+	SAVE_ERRNO(close(fd));
+	return err;
+}
+
+void trace_close(trace_t *trace)
+{
+	if (trace->hdr == NULL) {
+		return;
+	}
+
+	munmap(trace->hdr, trace->map_len);
+	trace->hdr = NULL;
+	trace->recs = NULL;
+	trace->map_len = 0;
+}
+
+void trace_add(trace_t *trace, uint8_t type, uint8_t addr, uint32_t arg,
+		const uint8_t *data, size_t len)
+{
+	trace_hdr_t *hdr = trace->hdr;
+	trace_rec_t *rec;
+	uint64_t seq;
+
+	seq = atomic_fetch_add_explicit(&hdr->head, 1, memory_order_relaxed);
+	rec = &trace->recs[seq & (hdr->rec_cnt - 1)];
+
+	// Mark record invalid while it is overwritten
+	atomic_store_explicit(&rec->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	rec->time = time_now_ns();
+	rec->arg = arg;
+	rec->len = (len > UINT16_MAX) ? UINT16_MAX : len;
+	rec->type = type;
+	rec->addr = addr;
+	if (len > TRACE_DATA_LEN) {
+		len = TRACE_DATA_LEN;
+	}
+	if (data != NULL) {
+		memcpy(rec->data, data, len);
+	}
+
+	atomic_store_explicit(&rec->seq, seq + 1, memory_order_release);
+}
+
+/**
+ * Check if mapped file contains a usable trace ring
+ */
+static bool _trace_hdr_valid(const trace_hdr_t *hdr, size_t rec_cnt)
+{
+	return hdr->magic == TRACE_MAGIC &&
+		hdr->version == TRACE_VERSION &&
+		hdr->rec_size == sizeof(trace_rec_t) &&
+		hdr->rec_cnt == rec_cnt;
+}
@@ -0,0 +1,163 @@
+/**
+ * trace.h - Binary trace ring buffer
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*
+ * The trace ring is a memory mapped file of a header followed by a power of
+ * two amount of fixed size records. Records are claimed by incrementing the
+ * head counter and written without locks or formatting. Because the file
+ * is shared memory, the records survive a crash of the process and can be
+ * printed afterwards with sx1231_trace.
+ */
+
+#define TRACE_MAGIC	0x52545853	// "SXTR"
+#define TRACE_VERSION	1
+
+/**
+ * Default amount of records in a trace ring
+ */
+#define TRACE_DEFAULT_RECORDS 16384
+
+/**
+ * Maximum amount of data bytes stored in a record
+ */
+#define TRACE_DATA_LEN	40
+
+/**
+ * Trace record types
+ */
+enum {
+	TRACE_SPI_READ = 1,	/**< Register read, arg: transfer duration(ns) */
+	TRACE_SPI_WRITE,	/**< Register write, arg: transfer duration(ns) */
+	TRACE_SPI_ERROR,	/**< Failed transfer, arg: error code */
+	TRACE_MODE,		/**< Mode switch, addr: old mode, arg: new mode */
+	TRACE_REFILL,		/**< FIFO refill, len: bytes, arg: headroom */
+	TRACE_UNDERRUN,		/**< FIFO ran empty, len: bytes to refill */
+	TRACE_SEND_START,	/**< Start of transmission, len: bytes */
+	TRACE_SEND_DONE,	/**< End of transmission, arg: error code */
+	TRACE_RECOVER,		/**< Module reset after error, arg: error code */
+};
+
+/**
+ * Trace record
+ *
+ * Records are 64 bytes, so every record occupies a single cache line.
+ */
+typedef struct {
+	_Atomic uint64_t seq;	/**< Sequence number + 1, 0 while written */
+	uint64_t time;		/**< CLOCK_MONOTONIC time in ns */
+	uint32_t arg;		/**< Type specific argument */
+	uint16_t len;		/**< Length of the data, also if truncated */
+	uint8_t type;		/**< Record type, TRACE_* */
+	uint8_t addr;		/**< Register address */
+	uint8_t data[TRACE_DATA_LEN]; /**< First data bytes */
+} trace_rec_t;
+
+/**
+ * Trace file header
+ */
+typedef struct {
+	uint32_t magic;		/**< TRACE_MAGIC */
+	uint16_t version;	/**< TRACE_VERSION */
+	uint16_t rec_size;	/**< sizeof(trace_rec_t) */
+	uint32_t rec_cnt;	/**< Amount of records, power of two */
+	uint32_t reserved;
+	_Atomic uint64_t head;	/**< Sequence number of next record */
+	uint8_t pad[40];	/**< Align records to 64 bytes */
+} trace_hdr_t;
+
+/**
+ * Trace ring handle
+ */
+typedef struct {
+	trace_hdr_t *hdr;	/**< Mapped file, NULL if not opened */
+	trace_rec_t *recs;	/**< Records following the header */
+	size_t map_len;		/**< Length of the mapping */
+} trace_t;
+
+/**
+ * Open trace ring file
+ *
+ * An existing file with the same amount of records is appended to, so
+ * multiple processes can trace into the same file. A new or empty file, or a
+ * trace file of a different size or version, is (re)initialized. Any other
+ * existing file is left alone.
+ *
+ * @param trace		Trace handle to initialize
+ * @param path		Path of the trace file
+ * @param rec_cnt	Amount of records, rounded up to a power of two
+ *
+ * @returns	0 on success, ERR_TRACE if the file can't be opened or isn't a
+ *		trace file
+ */
+int trace_open(trace_t *trace, const char *path, size_t rec_cnt);
+
+/**
+ * Close trace ring
+ *
+ * @param trace		Trace handle, may be closed already
+ */
+void trace_close(trace_t *trace);
+
+/**
+ * Add record to trace ring
+ *
+ * Safe to call concurrently from multiple threads and processes.
+ *
+ * @param trace		Opened trace handle
+ * @param type		Record type, TRACE_*
+ * @param addr		Register address
+ * @param arg		Type specific argument
+ * @param data		Data bytes, or NULL to only record the length
+ * @param len		Length of data, only TRACE_DATA_LEN bytes are stored
+ */
+void trace_add(trace_t *trace, uint8_t type, uint8_t addr, uint32_t arg,
+		const uint8_t *data, size_t len);
+
+/**
+ * Add record if tracing is compiled in and the ring is opened
+ *
+ * Arguments are not evaluated if the ring is not opened.
+ */
+#ifdef WITH_TRACE
+# define TRACE(T, TYPE, ADDR, ARG, DATA, LEN) \
+	do { \
+		if ((T)->hdr != NULL) \
+			trace_add((T), (TYPE), (ADDR), (ARG), (DATA), (LEN)); \
+	} while (0)
+#else
+# define TRACE(T, TYPE, ADDR, ARG, DATA, LEN) do { } while (0)
+#endif
+
+#endif // __TRACE_H__
@@ -0,0 +1,96 @@
+/**
+ * sim_test.h - Helpers for tests against the simulated radio
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __SIM_TEST_H__
+#define __SIM_TEST_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sx1231_ods.h"
+#include "spi_sim.h"
+
+// Bit rate of tests. The FIFO then lasts long enough that refills aren't
+// late when the tests share a CPU with other processes.
+#define SIM_TEST_BITRATE	4.8
+
+/**
+ * Fail test if condition is false
+ */
+#define CHECK(COND) do { \
+		if (!(COND)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", \
+					__FILE__, __LINE__, #COND); \
+			exit(EXIT_FAILURE); \
+		} \
+	} while (0)
+
+/**
+ * Fail test if library call doesn't return ERR_OK
+ */
+#define CHECK_OK(CALL) do { \
+		int _check_err = (CALL); \
+		if (_check_err != ERR_OK) { \
+			fprintf(stderr, "%s:%d: %s returned %d\n", \
+					__FILE__, __LINE__, #CALL, \
+					_check_err); \
+			exit(EXIT_FAILURE); \
+		} \
+	} while (0)
+
+/**
+ * Open and configure simulated radio, recording the bytes it sends
+ */
+static inline void sim_test_open(rf_dev_t *dev, spi_sim_byte_t *log,
+				size_t len, size_t *cnt)
+{
+	CHECK_OK(rf_open(dev, "sim", RF_SPI_SPEED_DEFAULT));
+	CHECK_OK(rf_config(dev, 433.92, 0, SX1231_MODULATION_OOK,
+				SIM_TEST_BITRATE));
+	CHECK_OK(spi_sim_record(&dev->spi, log, len, cnt));
+}
+
+/**
+ * Check that recorded bytes were sent back to back, in one transmission
+ */
+static inline void sim_test_check_continuous(rf_dev_t *dev,
+				const spi_sim_byte_t *log, size_t cnt)
+{
+	for (size_t i = 1; i < cnt; i++) {
+		if (log[i].start - log[i - 1].start != dev->byte_time) {
+			fprintf(stderr, "Byte %zu sent %llu ns after previous, "
+					"expected %llu ns\n", i,
+					(unsigned long long)
+					(log[i].start - log[i - 1].start),
+					(unsigned long long) dev->byte_time);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+#endif // __SIM_TEST_H__
@@ -0,0 +1,126 @@
+/**
+ * test_async.c - Send frames through the asynchronous transmit queue
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "config.h"
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "sim_test.h"
+#include "sx1231_ods_time.h"
+
+#define FRAME_CNT	6	// Frames submitted by main thread
+#define FRAME_LEN	3
+
+/**
+ * Callback state, one per frame
+ */
+typedef struct {
+	rf_dev_t *dev;
+	unsigned int idx;		/**< Frame number */
+	rf_tx_result_t res;		/**< Result passed to callback */
+} frame_ctx_t;
+
+static uint8_t _frames[FRAME_CNT + 1][FRAME_LEN];
+static frame_ctx_t _ctx[FRAME_CNT + 1];
+static unsigned int _order[FRAME_CNT + 1];
+static atomic_uint _done;
+
+static void _tx_done(void *ctx, const rf_tx_result_t *res)
+{
+	frame_ctx_t *fc = ctx;
+	unsigned int n = atomic_load(&_done);
+
+	fc->res = *res;
+	_order[n] = fc->idx;
+
+	// Last frame of main thread queues one more from the TX thread
+	if (fc->idx == FRAME_CNT - 1) {
+		CHECK_OK(rf_submit(fc->dev, _frames[FRAME_CNT], FRAME_LEN,
+					_tx_done, &_ctx[FRAME_CNT]));
+	}
+
+	atomic_store(&_done, n + 1);
+}
+
+int main(void)
+{
+	rf_dev_t dev;
+	spi_sim_byte_t log[(FRAME_CNT + 1) * FRAME_LEN + 1];
+	size_t cnt;
+	uint64_t deadline;
+	unsigned int i;
+
+	sim_test_open(&dev, log, sizeof(log) / sizeof(log[0]), &cnt);
+
+	for (i = 0; i <= FRAME_CNT; i++) {
+		memset(_frames[i], i, FRAME_LEN);
+		_ctx[i].dev = &dev;
+		_ctx[i].idx = i;
+	}
+	atomic_init(&_done, 0);
+
+	CHECK(rf_submit(&dev, _frames[0], FRAME_LEN, NULL, NULL) == ERR_INVAL);
+	CHECK_OK(rf_async_start(&dev));
+	for (i = 0; i < FRAME_CNT; i++) {
+		CHECK_OK(rf_submit(&dev, _frames[i], FRAME_LEN, _tx_done,
+					&_ctx[i]));
+	}
+
+	// Frame submitted by callback must be sent before stopping
+	deadline = time_now_ns() + 10 * NSEC_PER_SEC;
+	while (atomic_load(&_done) != FRAME_CNT + 1) {
+		CHECK(time_now_ns() < deadline);
+		time_sleep_until_ns(time_now_ns() + NSEC_PER_MSEC);
+	}
+	CHECK_OK(rf_async_stop(&dev));
+	CHECK(rf_submit(&dev, _frames[0], FRAME_LEN, NULL, NULL) == ERR_INVAL);
+
+	// Frames are sent, and completed, in submission order
+	for (i = 0; i <= FRAME_CNT; i++) {
+		const rf_tx_result_t *res = &_ctx[i].res;
+
+		CHECK(_order[i] == i);
+		CHECK(res->err == ERR_OK);
+		CHECK(res->submitted <= res->dequeued);
+		CHECK(res->dequeued <= res->tx_start);
+		CHECK(res->tx_start < res->tx_end);
+		if (i != 0) {
+			CHECK(_ctx[i - 1].res.tx_end <= res->tx_start);
+		}
+	}
+	CHECK(cnt == (FRAME_CNT + 1) * FRAME_LEN);
+	for (i = 0; i < cnt; i++) {
+		CHECK(log[i].val == i / FRAME_LEN);
+	}
+
+	rf_close(&dev);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+/**
+ * test_bits.c - Build a bit-packed frame and send it to the simulated radio
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "sim_test.h"
+#include "bits.h"
+
+int main(void)
+{
+	static const uint8_t bytes[] = { 0xc3, 0x5a };
+	// 101, ten ones, c3 5a unaligned, 0
+	static const uint8_t expect[] = {
+		0xbf, 0xfe, 0x1a, 0xd0
+	};
+	rf_dev_t dev;
+	spi_sim_byte_t log[8];
+	size_t cnt;
+	uint8_t buf[4];
+	bits_builder_t bb;
+
+	// Build frame that doesn't end on a byte boundary
+	bits_init(&bb, buf, sizeof(buf));
+	CHECK_OK(bits_append(&bb, 0x5, 3));
+	CHECK_OK(bits_append_run(&bb, 1, 10));
+	CHECK_OK(bits_append_bytes(&bb, bytes, sizeof(bytes)));
+	CHECK_OK(bits_append(&bb, 0x0, 1));
+	CHECK(bits_len(&bb) == 30);
+	CHECK(memcmp(buf, expect, sizeof(expect)) == 0);
+
+	// Full buffer is refused, without changing the frame
+	CHECK(bits_append(&bb, 0x7, 3) == ERR_RANGE);
+	CHECK(bits_len(&bb) == 30);
+	CHECK(memcmp(buf, expect, sizeof(expect)) == 0);
+
+	// Last byte is sent padded with zeros
+	sim_test_open(&dev, log, sizeof(log) / sizeof(log[0]), &cnt);
+	CHECK_OK(rf_send_bits(&dev, buf, bits_len(&bb)));
+	CHECK(cnt == sizeof(expect));
+	for (size_t i = 0; i < cnt; i++) {
+		CHECK(log[i].val == expect[i]);
+	}
+	sim_test_check_continuous(&dev, log, cnt);
+
+	rf_close(&dev);
+
+	return EXIT_SUCCESS;
+}
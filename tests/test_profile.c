@@ -0,0 +1,99 @@
+/**
+ * test_profile.c - Apply profiles to the simulated radio and read them back
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "sim_test.h"
+#include "sx1231_enums.h"
+
+/**
+ * Check that the module holds all registers of a profile
+ */
+static void _check_applied(rf_dev_t *dev, const rf_profile_t *prof)
+{
+	uint8_t regs[RF_REG_CNT];
+
+	CHECK_OK(spi_read_regs(&dev->spi, 0x01, &regs[1], RF_REG_CNT - 1));
+	for (unsigned int reg = 1; reg < RF_REG_CNT; reg++) {
+		if (prof->mask[reg / 8] & (1 << (reg % 8))) {
+			CHECK(regs[reg] == prof->regs[reg]);
+		}
+	}
+}
+
+int main(void)
+{
+	rf_dev_t dev;
+	rf_profile_t same, other, freq_only;
+	unsigned long xfers;
+	uint64_t byte_time;
+	uint8_t val;
+
+	sim_test_open(&dev, NULL, 0, NULL);
+
+	// Profile of active configuration doesn't access the module
+	CHECK_OK(rf_profile_compile(&same, 433.92, 0, SX1231_MODULATION_OOK,
+				SIM_TEST_BITRATE));
+	xfers = dev.spi.xfer_cnt;
+	CHECK_OK(rf_apply_profile(&dev, &same));
+	CHECK(dev.spi.xfer_cnt == xfers);
+
+	// Other profile is written in a single transaction
+	CHECK_OK(rf_profile_compile(&other, 868.3, 20, SX1231_MODULATION_FSK,
+				2 * SIM_TEST_BITRATE));
+	xfers = dev.spi.xfer_cnt;
+	byte_time = dev.byte_time;
+	CHECK_OK(rf_apply_profile(&dev, &other));
+	CHECK(dev.spi.xfer_cnt == xfers + 1);
+	_check_applied(&dev, &other);
+
+	// Timing follows the new bit rate
+	CHECK(dev.byte_time > byte_time / 2 - 1000 &&
+		dev.byte_time < byte_time / 2 + 1000);
+
+	// Registers outside the mask are left alone
+	CHECK_OK(rf_profile_compile(&freq_only, 915, 0, SX1231_MODULATION_OOK,
+				SIM_TEST_BITRATE));
+	memset(freq_only.mask, 0, sizeof(freq_only.mask));
+	for (unsigned int reg = RegFrfMsb; reg <= RegFrfLsb; reg++) {
+		freq_only.mask[reg / 8] |= 1 << (reg % 8);
+	}
+	CHECK_OK(rf_apply_profile(&dev, &freq_only));
+	_check_applied(&dev, &freq_only);
+	CHECK_OK(spi_read_reg(&dev.spi, RegBitrateMsb, &val));
+	CHECK(val == other.regs[RegBitrateMsb]);
+	CHECK_OK(spi_read_reg(&dev.spi, RegDataModul, &val));
+	CHECK(val == other.regs[RegDataModul]);
+
+	rf_close(&dev);
+
+	return EXIT_SUCCESS;
+}
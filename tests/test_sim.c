@@ -0,0 +1,62 @@
+/**
+ * test_sim.c - Send a frame larger than the FIFO to the simulated radio
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "config.h"
+
+#include <stdint.h>
+
+#include "sim_test.h"
+
+#define FRAME_LEN	200
+
+int main(void)
+{
+	rf_dev_t dev;
+	uint8_t frame[FRAME_LEN];
+	spi_sim_byte_t log[FRAME_LEN + 1];
+	size_t cnt;
+
+	for (size_t i = 0; i < FRAME_LEN; i++) {
+		frame[i] = i * 7;
+	}
+
+	sim_test_open(&dev, log, FRAME_LEN + 1, &cnt);
+
+	CHECK_OK(rf_send(&dev, frame, FRAME_LEN));
+
+	// Needs several refills, without the FIFO running empty in between
+	CHECK(cnt == FRAME_LEN);
+	for (size_t i = 0; i < FRAME_LEN; i++) {
+		CHECK(log[i].val == frame[i]);
+	}
+	sim_test_check_continuous(&dev, log, cnt);
+
+	rf_close(&dev);
+
+	return EXIT_SUCCESS;
+}
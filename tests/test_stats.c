@@ -0,0 +1,89 @@
+/**
+ * test_stats.c - Check statistics against the simulated radio
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "config.h"
+
+#include <stdint.h>
+#include <limits.h>
+
+#include "sim_test.h"
+
+#define FRAME_LEN	100
+#define FRAMED_LEN	20
+
+int main(void)
+{
+	static const rf_framing_t framing = {
+		.preamble_len = 3,
+		.sync = { 0x2d, 0xd4 },
+		.sync_len = 2,
+		.manchester = true,
+	};
+	rf_dev_t dev;
+	uint8_t frame[FRAME_LEN] = { 0 };
+	spi_sim_byte_t log[FRAME_LEN];
+	size_t cnt;
+	rf_stats_t stats;
+	uint64_t chip_time, airtime;
+
+	sim_test_open(&dev, log, FRAME_LEN, &cnt);
+	chip_time = dev.byte_time;
+
+	rf_get_stats(&dev, &stats);
+	CHECK(stats.sends == 0);
+	CHECK(stats.airtime == 0);
+	CHECK(stats.refills == 0);
+	CHECK(stats.min_headroom == UINT_MAX);
+
+	// Frame that needs refills
+	CHECK_OK(rf_send(&dev, frame, FRAME_LEN));
+	CHECK(cnt == FRAME_LEN);
+	rf_get_stats(&dev, &stats);
+	CHECK(stats.sends == 1);
+	CHECK(stats.airtime == FRAME_LEN * chip_time);
+	CHECK(stats.refills > 0);
+	CHECK(stats.min_headroom != UINT_MAX);
+	CHECK(stats.underruns == 0);
+	CHECK(stats.xfers > 0);
+	airtime = stats.airtime;
+
+	// Airtime includes the preamble and sync word the module adds, and
+	// Manchester encoding doubles the time of the data
+	CHECK_OK(rf_set_framing(&dev, &framing));
+	CHECK(dev.header_time == (3 + 2) * chip_time);
+	CHECK_OK(rf_send(&dev, frame, FRAMED_LEN));
+	rf_get_stats(&dev, &stats);
+	CHECK(stats.sends == 2);
+	CHECK(stats.airtime - airtime ==
+			(3 + 2) * chip_time + FRAMED_LEN * 2 * chip_time);
+	CHECK(stats.underruns == 0);
+
+	rf_close(&dev);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,100 @@
+/**
+ * test_train.c - Send a frame train to the simulated radio and check the gaps
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "sim_test.h"
+
+#define MAX_LEN		32
+
+/**
+ * Expected transmission, built bit by bit
+ */
+typedef struct {
+	uint8_t buf[MAX_LEN];
+	size_t bits;
+} expect_t;
+
+static void _expect_bits(expect_t *e, const uint8_t *data, size_t bits)
+{
+	for (size_t i = 0; i < bits; i++) {
+		if (data != NULL && (data[i / 8] & (0x80 >> (i % 8)))) {
+			e->buf[e->bits / 8] |= 0x80 >> (e->bits % 8);
+		}
+		e->bits++;
+	}
+}
+
+int main(void)
+{
+	static const uint8_t frame1[] = { 0xff, 0x81 };
+	static const uint8_t frame2[] = { 0xa5 };
+	rf_dev_t dev;
+	spi_sim_byte_t log[MAX_LEN];
+	size_t cnt;
+	expect_t expect;
+	unsigned int bit_us;
+
+	sim_test_open(&dev, log, MAX_LEN, &cnt);
+	bit_us = dev.byte_time / 8 / 1000;
+
+	// Gaps that aren't a whole amount of bytes
+	struct iovec iov1 = { (void *) frame1, sizeof(frame1) };
+	struct iovec iov2 = { (void *) frame2, sizeof(frame2) };
+	rf_train_entry_t train[] = {
+		{ &iov1, 1, 3, 12 * bit_us },
+		{ &iov2, 1, 2, 5 * bit_us },
+	};
+
+	memset(&expect, 0, sizeof(expect));
+	for (int i = 0; i < 3; i++) {
+		_expect_bits(&expect, frame1, 16);
+		_expect_bits(&expect, NULL, 12);
+	}
+	_expect_bits(&expect, frame2, 8);
+	_expect_bits(&expect, NULL, 5);
+	_expect_bits(&expect, frame2, 8);
+
+	CHECK_OK(rf_send_train(&dev, train, 2));
+
+	// Every gap is part of the transmission, so the frames are exactly
+	// the gap apart
+	CHECK(cnt == (expect.bits + 7) / 8);
+	for (size_t i = 0; i < cnt; i++) {
+		CHECK(log[i].val == expect.buf[i]);
+	}
+	sim_test_check_continuous(&dev, log, cnt);
+
+	rf_close(&dev);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,93 @@
+/**
+ * test_tx_sm.c - Drive a non-blocking transmission with poll()
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "config.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <poll.h>
+
+#include "sim_test.h"
+
+#define FRAME_LEN	300
+#define NEXT_LEN	10
+
+int main(void)
+{
+	rf_dev_t dev;
+	uint8_t frame[FRAME_LEN];
+	spi_sim_byte_t log[FRAME_LEN + NEXT_LEN + 1];
+	size_t cnt;
+	struct pollfd pfd;
+	unsigned long xfers;
+	unsigned int steps = 0;
+	bool done = false;
+
+	for (size_t i = 0; i < FRAME_LEN; i++) {
+		frame[i] = i * 3;
+	}
+
+	sim_test_open(&dev, log, sizeof(log) / sizeof(log[0]), &cnt);
+
+	pfd.fd = rf_tx_fd(&dev);
+	pfd.events = POLLIN;
+	CHECK(pfd.fd >= 0);
+
+	xfers = dev.spi.xfer_cnt;
+	CHECK_OK(rf_tx_begin(&dev, frame, FRAME_LEN));
+
+	// Only one transmission at a time
+	CHECK(rf_tx_begin(&dev, frame, FRAME_LEN) == ERR_INVAL);
+
+	// Driven by the timer, which fires only when a step is due
+	while (!done) {
+		CHECK(poll(&pfd, 1, 5000) == 1);
+		CHECK_OK(rf_tx_step(&dev, &done));
+		steps++;
+	}
+	CHECK(rf_tx_fd(&dev) == pfd.fd);
+
+	// A few steps per refill, not a busy loop. Waking from standby adds
+	// a step per ModeReady poll.
+	CHECK(steps < 100);
+	CHECK(dev.spi.xfer_cnt - xfers < 200);
+
+	CHECK(cnt == FRAME_LEN);
+	for (size_t i = 0; i < FRAME_LEN; i++) {
+		CHECK(log[i].val == frame[i]);
+	}
+	sim_test_check_continuous(&dev, log, cnt);
+
+	// Device is released when done
+	CHECK_OK(rf_send(&dev, frame, NEXT_LEN));
+	CHECK(cnt == FRAME_LEN + NEXT_LEN);
+
+	rf_close(&dev);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+/**
+ * test_warm_start.c - Repeated rf_config() on an idle, configured radio
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "config.h"
+
+#include <stdint.h>
+
+#include "sim_test.h"
+#include "sx1231_enums.h"
+
+/**
+ * Configure with test parameters, returning the amount of SPI transfers
+ */
+static unsigned long _config(rf_dev_t *dev)
+{
+	unsigned long xfers = dev->spi.xfer_cnt;
+
+	CHECK_OK(rf_config(dev, 433.92, 0, SX1231_MODULATION_OOK,
+				SIM_TEST_BITRATE));
+
+	return dev->spi.xfer_cnt - xfers;
+}
+
+int main(void)
+{
+	static const uint8_t frame[] = { 0x55, 0xaa };
+	rf_dev_t dev;
+	uint8_t val;
+
+	sim_test_open(&dev, NULL, 0, NULL);
+
+	// Configured and idle module is left alone
+	CHECK(_config(&dev) == 0);
+
+	// Also with automatic modes, once the transmission finished
+	CHECK_OK(rf_set_auto_modes(&dev, true));
+	CHECK_OK(rf_send(&dev, frame, sizeof(frame)));
+	CHECK_OK(rf_flush(&dev));
+	CHECK(_config(&dev) == 0);
+	CHECK_OK(spi_read_reg(&dev.spi, RegAutoModes, &val));
+	CHECK(val != 0);
+
+	// And in another idle mode
+	CHECK_OK(rf_set_idle_policy(&dev, RF_IDLE_FS));
+	CHECK(_config(&dev) == 0);
+	CHECK_OK(spi_read_reg(&dev.spi, RegOpMode, &val));
+	CHECK((val & 0x1c) == OP_MODE_MODE_FS);
+
+	// Changed configuration is reset
+	CHECK_OK(rf_set_frequency(&dev, 868.3));
+	CHECK(_config(&dev) != 0);
+	CHECK(_config(&dev) == 0);
+
+	rf_close(&dev);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,54 @@
+# Smoke test of sx1231_raw against the simulated radio
+#
+# Sends a line that doesn't fit the FIFO, so it needs several refills, and
+# checks that sx1231_raw succeeds without FIFO underruns. Optionally selects
+# the refill mode, sends the line with rf_send_at() instead of as a stream,
+# and checks the amount of SPI transfers the simulated radio saw.
+#
+# Usage:
+#   cmake -DSX1231_RAW=<path> -DWORK_DIR=<dir> [-DREFILL=<poll|predict>]
+#         [-DINTERVAL=<us>] [-DMIN_XFERS=<n>] [-DMAX_XFERS=<n>]
+#         -P sim_smoke_test.cmake
+#=============================================================================
+
+set(line "")
+foreach(i RANGE 1 300)
+	set(line "${line}a55a")
+endforeach(i)
+set(input_file "${WORK_DIR}/sim_smoke_${REFILL}_${INTERVAL}.hex")
+file(WRITE "${input_file}" "${line}\n")
+
+set(args -d sim -v)
+if (REFILL)
+	list(APPEND args "--refill=${REFILL}")
+endif (REFILL)
+if (INTERVAL)
+	list(APPEND args "--interval=${INTERVAL}")
+endif (INTERVAL)
+
+execute_process(
+	COMMAND "${SX1231_RAW}" ${args}
+	INPUT_FILE "${input_file}"
+	RESULT_VARIABLE result
+	OUTPUT_VARIABLE output
+	ERROR_VARIABLE output
+)
+message("${output}")
+
+if (NOT result EQUAL 0)
+	message(FATAL_ERROR "sx1231_raw failed: ${result}")
+endif (NOT result EQUAL 0)
+if (NOT output MATCHES "SIM: [^\n]* 600 bytes transmitted, 0 underruns")
+	message(FATAL_ERROR "Simulated radio saw an underrun, or missing data")
+endif (NOT output MATCHES "SIM: [^\n]* 600 bytes transmitted, 0 underruns")
+
+string(REGEX MATCH "SIM: ([0-9]+) transfers" match "${output}")
+set(xfers "${CMAKE_MATCH_1}")
+if (MIN_XFERS AND xfers LESS MIN_XFERS)
+	message(FATAL_ERROR "${xfers} SPI transfers, expected at least "
+		"${MIN_XFERS}")
+endif (MIN_XFERS AND xfers LESS MIN_XFERS)
+if (MAX_XFERS AND xfers GREATER MAX_XFERS)
+	message(FATAL_ERROR "${xfers} SPI transfers, expected at most "
+		"${MAX_XFERS}")
+endif (MAX_XFERS AND xfers GREATER MAX_XFERS)
@@ -35,7 +35,6 @@
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
-#include <time.h>
 #include <getopt.h>
 
 #include "sx1231_ods.h"
@@ -62,6 +61,9 @@
 #define KAKU_FRAME_REPEAT       (4)		// Number of times frame is repeated
 #define KAKU_INTER_FRAME_GAP_US (7700)		// Time in us between frame repeats
 
+// Preamble and stop bit, shared by all frames
+static const uint8_t kaku_preamble[KAKU_PREAMBLE_IVALS] = { 0xff };
+static const uint8_t kaku_stop[KAKU_END_IVALS] = { 0xff };
 
 
 /**
@@ -122,14 +124,10 @@ static uint8_t *encode_kaku(uint8_t *enc_data, uint8_t b)
 int kaku_send(rf_dev_t *dev, uint8_t data[4])
 {
 	int ret;
-	uint8_t frame_buf[KAKU_FRAME_IVALS];
-  	uint8_t *frame_head = frame_buf;
+	uint8_t data_buf[KAKU_DATA_IVALS];
+  	uint8_t *frame_head = data_buf;
 
-	memset(frame_buf, 0, sizeof(frame_buf));
-
-	// Preamble
-	*frame_head = 0xff;
-	frame_head += KAKU_PREAMBLE_IVALS;
+	memset(data_buf, 0, sizeof(data_buf));
 
 	// Data
 	frame_head = encode_kaku(frame_head, data[0]);
@@ -137,20 +135,18 @@ int kaku_send(rf_dev_t *dev, uint8_t data[4])
 	frame_head = encode_kaku(frame_head, data[2]);
 	frame_head = encode_kaku(frame_head, data[3]);
 
-	// Stop bit
-	*frame_head = 0xff;
-
-	for (int i=0; i < KAKU_FRAME_REPEAT; i++) {
-		ret = rf_send(dev, frame_buf, sizeof(frame_buf));
-		if (ret != ERR_OK) {
-			return ret;
-		}
-
-		// Inter Frame Gap
-		struct timespec ifg_time = {
-			0, KAKU_INTER_FRAME_GAP_US * 1000
-		};
-		nanosleep(&ifg_time, NULL);
+	// Send all repeats, including inter frame gaps, in one transmission
+	struct iovec frame[3] = {
+		{ (void *) kaku_preamble, sizeof(kaku_preamble) },
+		{ data_buf, sizeof(data_buf) },
+		{ (void *) kaku_stop, sizeof(kaku_stop) }
+	};
+	rf_train_entry_t train = {
+		frame, 3, KAKU_FRAME_REPEAT, KAKU_INTER_FRAME_GAP_US
+	};
+	ret = rf_send_train(dev, &train, 1);
+	if (ret != ERR_OK) {
+		return ret;
 	}
 
 	return ERR_OK;
@@ -234,7 +230,7 @@ int main(int argc, char *argv[])
 	}
 
 	// Open SX1231
-	if (rf_open(&dev, dev_path) != 0) {
+	if (rf_open(&dev, dev_path, RF_SPI_SPEED_DEFAULT) != 0) {
 		exit(EXIT_FAILURE);
 	}
 
@@ -39,12 +39,14 @@
 #include <getopt.h>
 #include <assert.h>
 #include <errno.h>
+#include <time.h>
 
 #include <sx1231_ods.h>
 
 #include "dehexify.h"
 
-#define MAX_DATA_LEN (1024 * 1024)
+#define MAX_DATA_LEN (1024 * 1024)	// Line length limit with --interval
+#define INPUT_CHUNK_LEN 512		// Hex digits to read at once, even
 
 /**
  * Reverse bit order in a byte
@@ -58,6 +60,23 @@ static inline uint8_t reverse_byte(uint8_t b)
 	return b;
 }
 
+/**
+ * Print non-empty buckets of a histogram
+ */
+static void print_hist(const char *name, const rf_hist_t *hist)
+{
+	int i;
+
+	fprintf(stderr, "%s:", name);
+	for (i = 0; i < RF_HIST_BUCKETS; i++) {
+		if (hist->count[i] != 0) {
+			fprintf(stderr, " %s%lu us: %lu", (i == 0) ? "<" : ">=",
+				(i == 0) ? 2UL : 1UL << i, hist->count[i]);
+		}
+	}
+	fprintf(stderr, "\n");
+}
+
 void usage(const char *name)
 {
 	fprintf(stderr,
@@ -67,6 +86,8 @@ void usage(const char *name)
 		"\n"
 		"Options:\n"
 		"  -d, --device=PATH         SPI device file to use (default: " DEFAULT_DEV_PATH ")\n"
+		"  -s, --spi-speed=HZ        SPI clock speed in Hz, or 'auto' to use the\n"
+		"                            highest reliable speed (default: driver default)\n"
 		"  -f, --frequency=FREQ      Carrier frequency in MHz (default: 433.92 MHz)\n"
 		"  -m, --modulation=MOD      Modulation scheme: OOK or FSK (default: OOK)\n"
 		"  --fsk-deviation=FDEV      FSK frequency deviation in kHz (default: 5 kHz)\n"
@@ -83,18 +104,42 @@ void usage(const char *name)
 		"                            Default: PA0\n"
 #endif
 		"  --lsb-first               Send bytes LSB first\n"
+		"  --dio=N:CHIP:LINE         Wait for DIO pin N of module using GPIO LINE of\n"
+		"                            GPIO chip device CHIP, instead of polling. N can\n"
+		"                            be 0(PacketSent), 1(FifoLevel) or 5(ModeReady).\n"
+		"                            Can be used multiple times.\n"
+		"  --refill=MODE             FIFO refill mode: poll or predict (default: poll)\n"
+		"                            predict calculates the FIFO level from the bit\n"
+		"                            rate, instead of polling the module.\n"
+		"  --idle=MODE               Mode between transmissions: standby, fs, sleep\n"
+		"                            or adaptive (default: standby)\n"
+		"  --auto-modes              Let the module switch to TX and back by itself\n"
+		"  --wait=STRATEGY           How to wait for the module: spin, spin-sleep or\n"
+		"                            sleep (default: spin). spin-sleep and sleep\n"
+		"                            trade latency for less CPU usage.\n"
+		"  --interval=US             Start every transmission exactly US microseconds\n"
+		"                            after the previous one\n"
+#ifdef WITH_TRACE
+		"  --trace=FILE              Record SPI transfers in binary trace ring FILE,\n"
+		"                            print it with sx1231_trace\n"
+#endif
 		" -v                         Increase verbosity level, use multiple times\n"
 		"                            for more logging\n"
 		"  -h, --help                Print this help message\n"
 		"\n"
 		"Data is read from STDIN as a hexadecimal string of the bytes to send. Every line\n"
-		"of input is send seperately.\n"
-		, name);
+		"of input is send seperately. Lines are sent while they are read, so they can\n"
+		"be of any length. Lines longer than %d hex digits start transmitting before\n"
+		"the whole line is validated, if the rest of the line is invalid the\n"
+		"transmission is aborted, possibly after part of the line was sent.\n"
+		, name, INPUT_CHUNK_LEN);
 }
 
 int main(int argc, char *argv[])
 {
 	const char *dev_path = DEFAULT_DEV_PATH;
+	uint32_t spi_speed = RF_SPI_SPEED_DEFAULT;
+	unsigned long speed_arg;
 	rf_dev_t dev;
 
 	float freq = 433.92;
@@ -110,6 +155,15 @@ int main(int argc, char *argv[])
 	uint8_t *data;
 	int data_len;
 	bool lsb_first = false;
+	int refill_mode = RF_REFILL_POLL;
+	int wait_strategy = RF_WAIT_SPIN;
+	bool auto_modes = false;
+	int idle_policy = RF_IDLE_STDBY;
+	uint64_t interval = 0;
+	uint64_t deadline = 0;
+	char *dio_chip[RF_DIO_CNT] = { NULL };
+	unsigned int dio_line[RF_DIO_CNT];
+	const char *trace_path = NULL;
 
 	int ret;
 	int retval = EXIT_SUCCESS;
@@ -119,6 +173,7 @@ int main(int argc, char *argv[])
 		int option_index = 0;
 		static struct option long_options[] = {
 			{ "device",            required_argument,  0, 'd' },
+			{ "spi-speed",         required_argument,  0, 's' },
 			{ "frequency",         required_argument,  0, 'f' },
 			{ "modulation",        required_argument,  0, 'm' },
 			{ "fsk-deviation",     required_argument,  0,  0  },
@@ -126,13 +181,20 @@ int main(int argc, char *argv[])
 			{ "power",             required_argument,  0, 'p' },
 			{ "select-pa",         required_argument,  0,  0  },
 			{ "lsb-first",         no_argument,        0,  0  },
+			{ "refill",            required_argument,  0,  0  },
+			{ "dio",               required_argument,  0,  0  },
+			{ "wait",              required_argument,  0,  0  },
+			{ "auto-modes",        no_argument,        0,  0  },
+			{ "idle",              required_argument,  0,  0  },
+			{ "interval",          required_argument,  0,  0  },
+			{ "trace",             required_argument,  0,  0  },
 			{ "help",              no_argument,        0, 'h' },
 			{ 0, 0, 0, 0 }
 		};
 		int c;
 		char *endp;
 
-		c = getopt_long(argc, argv, "d:f:m:p:r:vh",
+		c = getopt_long(argc, argv, "d:s:f:m:p:r:vh",
 				long_options, &option_index);
 		if (c == -1)
 			break;
@@ -170,12 +232,105 @@ int main(int argc, char *argv[])
 				}
 			} else if (strcmp(optname, "lsb-first") == 0) {
 				lsb_first = true;
+			} else if (strcmp(optname, "dio") == 0) {
+				char *sep;
+				int dio;
+
+				dio = strtol(optarg, &endp, 10);
+				sep = strrchr(optarg, ':');
+				if (*endp != ':' || sep == endp ||
+						dio < 0 || dio >= RF_DIO_CNT) {
+					fprintf(stderr, "dio argument "
+							"must be N:CHIP:LINE\n");
+					exit(EXIT_FAILURE);
+				}
+				dio_line[dio] = strtoul(sep + 1, &endp, 0);
+				if (*endp != '\0') {
+					fprintf(stderr, "dio GPIO line "
+						"not a valid number\n");
+					exit(EXIT_FAILURE);
+				}
+				*sep = '\0';
+				dio_chip[dio] = strchr(optarg, ':') + 1;
+			} else if (strcmp(optname, "refill") == 0) {
+				if (strcasecmp(optarg, "poll") == 0) {
+					refill_mode = RF_REFILL_POLL;
+				} else if (strcasecmp(optarg, "predict") == 0) {
+					refill_mode = RF_REFILL_PREDICT;
+				} else {
+					fprintf(stderr, "refill argument "
+							"must be 'poll' or 'predict'\n");
+					exit(EXIT_FAILURE);
+				}
+			} else if (strcmp(optname, "idle") == 0) {
+				if (strcasecmp(optarg, "standby") == 0) {
+					idle_policy = RF_IDLE_STDBY;
+				} else if (strcasecmp(optarg, "fs") == 0) {
+					idle_policy = RF_IDLE_FS;
+				} else if (strcasecmp(optarg, "sleep") == 0) {
+					idle_policy = RF_IDLE_SLEEP;
+				} else if (strcasecmp(optarg, "adaptive") == 0) {
+					idle_policy = RF_IDLE_ADAPTIVE;
+				} else {
+					fprintf(stderr, "idle argument must be "
+						"'standby', 'fs', 'sleep' or "
+						"'adaptive'\n");
+					exit(EXIT_FAILURE);
+				}
+			} else if (strcmp(optname, "interval") == 0) {
+				errno = 0;
+				interval = strtoull(optarg, &endp, 0);
+				if (*endp != '\0' || errno == ERANGE ||
+						interval == 0 ||
+						interval > UINT64_MAX / 1000) {
+					fprintf(stderr, "interval not a valid "
+							"number\n");
+					exit(EXIT_FAILURE);
+				}
+				interval *= 1000;
+			} else if (strcmp(optname, "trace") == 0) {
+				trace_path = optarg;
+			} else if (strcmp(optname, "auto-modes") == 0) {
+				auto_modes = true;
+			} else if (strcmp(optname, "wait") == 0) {
+				if (strcasecmp(optarg, "spin") == 0) {
+					wait_strategy = RF_WAIT_SPIN;
+				} else if (strcasecmp(optarg, "spin-sleep") == 0) {
+					wait_strategy = RF_WAIT_SPIN_SLEEP;
+				} else if (strcasecmp(optarg, "sleep") == 0) {
+					wait_strategy = RF_WAIT_SLEEP;
+				} else {
+					fprintf(stderr, "wait argument must be "
+						"'spin', 'spin-sleep' or 'sleep'\n");
+					exit(EXIT_FAILURE);
+				}
 			}
 		} else {
 			switch (c) {
 			case 'd':
 				dev_path = optarg;
 				break;
+			case 's':
+				if (strcasecmp(optarg, "auto") == 0) {
+					spi_speed = RF_SPI_SPEED_AUTO;
+					break;
+				}
+				errno = 0;
+				speed_arg = strtoul(optarg, &endp, 0);
+				if (endp == NULL || *endp != '\0') {
+					fprintf(stderr, "SPI speed "
+						"not a valid number\n");
+					exit(EXIT_FAILURE);
+				}
+				if (errno == ERANGE || speed_arg == 0 ||
+						speed_arg > 10000000) {
+					fprintf(stderr,
+						"SPI speed out of "
+						"range (0 < speed <= 10000000)\n");
+					exit(EXIT_FAILURE);
+				}
+				spi_speed = speed_arg;
+				break;
 			case 'f':
 				freq = strtof(optarg, &endp);
 				if (endp == NULL || *endp != '\0') {
@@ -258,11 +413,35 @@ int main(int argc, char *argv[])
 	}
 
 	// Open device
-	if (rf_open(&dev, dev_path) != 0) {
+	if (rf_open(&dev, dev_path, spi_speed) != 0) {
 		fprintf(stderr, "Failed to open device\n");
 		exit(EXIT_FAILURE);
 	}
 
+	if (trace_path != NULL) {
+		ret = rf_trace_open(&dev, trace_path, 0);
+		if (ret != ERR_OK) {
+			fprintf(stderr, "Failed to open trace file: %d\n", ret);
+			rf_close(&dev);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// Before rf_config(), so it can leave a configured module alone
+	ret = rf_set_auto_modes(&dev, auto_modes);
+	if (ret != ERR_OK) {
+		fprintf(stderr, "Failed to configure automatic modes: %d\n", ret);
+		rf_close(&dev);
+		exit(EXIT_FAILURE);
+	}
+
+	ret = rf_set_idle_policy(&dev, idle_policy);
+	if (ret != ERR_OK) {
+		fprintf(stderr, "Failed to set idle mode: %d\n", ret);
+		rf_close(&dev);
+		exit(EXIT_FAILURE);
+	}
+
 	// Configure device
 	ret = rf_config(&dev, freq, fdev, modulation, bit_rate);
 	if (ret != ERR_OK) {
@@ -278,83 +457,211 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	char *inp_data = NULL;
-	size_t inp_data_alloc_len = 0;
-	size_t inp_data_len = 0;
-	while (!feof(stdin)) {
-		if (inp_data_alloc_len != 0) {
-			free(inp_data);
-			inp_data = NULL;
-			inp_data_alloc_len = 0;
+	rf_set_refill_mode(&dev, refill_mode);
+	rf_set_wait_strategy(&dev, wait_strategy);
+
+	for (int i=0; i < RF_DIO_CNT; i++) {
+		if (dio_chip[i] == NULL) {
+			continue;
 		}
+		ret = rf_attach_dio(&dev, i, dio_chip[i], dio_line[i]);
+		if (ret != ERR_OK) {
+			fprintf(stderr, "Failed to attach DIO%d: %d\n", i, ret);
+			rf_close(&dev);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// Lines are read and sent in chunks, so they can be of any length.
+	// Only scheduled transmissions need the full line in memory.
+	char inp_data[INPUT_CHUNK_LEN + 1];
+	uint8_t chunk[INPUT_CHUNK_LEN / 2];
+	uint8_t *line_data = NULL;
+	size_t line_len = 0;
+	bool in_line = false;
+	bool skip_line = false;
+	bool streaming = false;
+	bool eof = false;
+	while (!eof) {
+		size_t inp_data_len;
+		bool eol;
 
-		// Read input data from input
-		ssize_t rlen;
-		
-		rlen = getline(&inp_data, &inp_data_alloc_len, stdin);
-		if (rlen < 0) {
+		// Read next chunk of input line
+		errno = 0;
+		if (fgets(inp_data, sizeof(inp_data), stdin) == NULL) {
 			if (errno != 0) {
 				perror("ERROR: Failed to read from standard input");
 				retval = EXIT_FAILURE;
+				break;
 			}
-			break;
-		} else if (rlen == 0 || rlen == 1) {
-			continue;
+			// Send last line if it lacks a newline
+			inp_data[0] = '\0';
+			eof = true;
 		}
-		inp_data_len = rlen - 1;
-		if (inp_data[inp_data_len] == '\n') {
-			inp_data[inp_data_len] = '\0';
+		inp_data_len = strlen(inp_data);
+		eol = (inp_data_len == 0 || inp_data[inp_data_len - 1] == '\n');
+		if (inp_data_len != 0 && inp_data[inp_data_len - 1] == '\n') {
+			inp_data[--inp_data_len] = '\0';
 		}
 
-		// Check input
-		if (inp_data_len & 1) {
-			fprintf(stderr, "ERROR: Data must consist of a even amount of bytes\n");
-			continue;
-		}
-		data_len = inp_data_len / 2;
-		if (data_len > MAX_DATA_LEN) {
-			fprintf(stderr, "ERROR: Data can not be longer than %u bytes\n", MAX_DATA_LEN);
-			continue;
+		if (!skip_line && inp_data_len != 0) {
+			// Check input
+			data_len = inp_data_len / 2;
+			if (inp_data_len & 1) {
+				fprintf(stderr, "ERROR: Data must consist of a even amount of bytes\n");
+				skip_line = true;
+			} else if (interval != 0 &&
+					line_len + data_len > MAX_DATA_LEN) {
+				fprintf(stderr, "ERROR: Data can not be longer than %u bytes\n", MAX_DATA_LEN);
+				skip_line = true;
+			} else if (dehexify(inp_data, data_len, chunk) != 0) {
+				fprintf(stderr, "ERROR: Unable to dehexify data\n");
+				skip_line = true;
+			}
+			if (skip_line && streaming) {
+				// Don't finish sending an invalid line
+				rf_stream_abort(&dev);
+				streaming = false;
+			}
 		}
 
-		// Dehexify input data
-		data = (uint8_t *) calloc(data_len, sizeof(uint8_t));
-		if (data == NULL) {
-			fprintf(stderr, "ERROR: Unable to allocate data memory\n");
-			free(inp_data);
-			retval = EXIT_FAILURE;
-			break;
+		if (!skip_line && inp_data_len != 0) {
+			// Reverse bytes if LSB first
+			if (lsb_first) {
+				for (int i=0; i < data_len; i++) {
+					chunk[i] = reverse_byte(chunk[i]);
+				}
+			}
+
+			in_line = true;
+			if (interval != 0) {
+				data = (uint8_t *) realloc(line_data,
+						line_len + data_len);
+				if (data == NULL) {
+					fprintf(stderr, "ERROR: Unable to allocate data memory\n");
+					retval = EXIT_FAILURE;
+					break;
+				}
+				line_data = data;
+				memcpy(line_data + line_len, chunk, data_len);
+				line_len += data_len;
+			} else {
+				ret = ERR_OK;
+				if (!streaming) {
+					ret = rf_stream_begin(&dev);
+					streaming = (ret == ERR_OK);
+				}
+				if (ret == ERR_OK) {
+					ret = rf_stream_write(&dev, chunk,
+							data_len);
+				}
+				if (ret != ERR_OK) {
+					// Stream is ended on errors
+					streaming = false;
+					fprintf(stderr, "ERROR: Failed sending command: %d\n", ret);
+					skip_line = true;
+				}
+			}
 		}
-		if (dehexify(inp_data, data_len, data) != 0) {
-			fprintf(stderr, "ERROR: Unable to dehexify data\n");
-			free(data);
+
+		if (!eol) {
 			continue;
 		}
 
-		// Reverse bytes if LSB first
-		if (lsb_first) {
-			for (int i=0; i < data_len; i++) {
-				data[i] = reverse_byte(data[i]);
+		// Send bits
+		if (streaming) {
+			ret = rf_stream_end(&dev);
+			streaming = false;
+		} else if (in_line && !skip_line && interval != 0) {
+			if (deadline == 0) {
+				struct timespec ts;
+
+				clock_gettime(CLOCK_MONOTONIC, &ts);
+				deadline = (uint64_t) ts.tv_sec * 1000000000 +
+					ts.tv_nsec;
 			}
+			deadline += interval;
+			ret = rf_send_at(&dev, line_data, line_len, deadline);
 		}
 
-		// Send bits
-		ret = rf_send(&dev, data, data_len);
+		if (in_line && !skip_line) {
+			if (ret == ERR_OK) {
+				fprintf(stderr, "OK\n");
+			} else {
+				fprintf(stderr, "ERROR: Failed sending command: %d\n", ret);
+			}
+		}
+
+		free(line_data);
+		line_data = NULL;
+		line_len = 0;
+		in_line = false;
+		skip_line = false;
+	}
 
-		free(data);
+	free(line_data);
 
-		if (ret == ERR_OK) {
-			fprintf(stderr, "OK\n");
-		} else {
-			fprintf(stderr, "ERROR: Failed sending command: %d\n", ret);
+	if (debug_level > 0) {
+		rf_fifo_tuning_t tuning;
+		rf_wait_stats_t stats;
+		rf_latency_t start_lat;
+		rf_stats_t rf_stats;
+
+		rf_get_fifo_tuning(&dev, &tuning);
+		fprintf(stderr, "FIFO: threshold %u bytes, refill chunk %u bytes, "
+			"refill latency mean %.1f us stddev %.1f us max %.1f us "
+			"(%lu samples)\n",
+			tuning.thresh, tuning.chunk,
+			tuning.latency_mean / 1e3, tuning.latency_stddev / 1e3,
+			tuning.latency_max / 1e3, tuning.samples);
+
+		rf_get_tx_start_latency(&dev, idle_policy, &start_lat);
+		fprintf(stderr, "TX start: latency mean %.1f us stddev %.1f us "
+			"max %.1f us (%lu samples)\n",
+			start_lat.mean / 1e3, rf_latency_stddev(&start_lat) / 1e3,
+			start_lat.max / 1e3, start_lat.count);
+
+		if (interval != 0) {
+			rf_get_start_error(&dev, NULL, &start_lat);
+			fprintf(stderr, "Start error: mean %.1f us stddev %.1f us "
+				"max %.1f us (%lu samples)\n",
+				start_lat.mean / 1e3,
+				rf_latency_stddev(&start_lat) / 1e3,
+				start_lat.max / 1e3, start_lat.count);
 		}
-	}
 
-	if (inp_data_alloc_len != 0) {
-		free(inp_data);
-		inp_data = NULL;
-		inp_data_alloc_len = 0;
+		rf_get_lock_wait(&dev, NULL, &start_lat);
+		fprintf(stderr, "Lock wait: mean %.1f us max %.1f us "
+			"(%lu samples)\n",
+			start_lat.mean / 1e3, start_lat.max / 1e3,
+			start_lat.count);
+
+		rf_get_stats(&dev, &rf_stats);
+		fprintf(stderr, "Stats: %lu sends, %.3f ms airtime, %lu transfers, "
+			"%lu SPI bytes, %lu polls, %lu refills, "
+			"%lu underruns, %.3f ms mode switching\n",
+			rf_stats.sends, rf_stats.airtime / 1e6, rf_stats.xfers,
+			rf_stats.spi_bytes, rf_stats.polls, rf_stats.refills,
+			rf_stats.underruns, rf_stats.mode_switch_time / 1e6);
+		if (rf_stats.refills != 0) {
+			fprintf(stderr, "Min. FIFO headroom: %u bytes\n",
+				rf_stats.min_headroom);
+		}
+		if (debug_level > 1) {
+			print_hist("Send time", &rf_stats.send_time);
+			print_hist("Mode switch time", &rf_stats.mode_switch);
+		}
+
+		rf_get_wait_stats(&dev, wait_strategy, &stats);
+		fprintf(stderr, "Wait: %lu waits, %.3f ms waiting, "
+			"%.3f ms CPU, %lu sleeps, wake-up latency avg %.1f us "
+			"max %.1f us\n",
+			stats.waits, stats.wait_time / 1e6,
+			stats.cpu_time / 1e6, stats.sleeps,
+			stats.sleeps ? stats.wake_latency_total / 1e3 / stats.sleeps : 0,
+			stats.wake_latency_max / 1e3);
 	}
+
 	rf_close(&dev);
 	return retval;
 }
@@ -31,23 +31,22 @@
 #include "sx1231_ods.h"
 
 #include <stdbool.h>
-#include <time.h>
 
 #define RTS_BITRATE		(1.655629139)
 					// Bit rate at which to serialize data.
 					// 1 basic RTS interval = 604 us.
 #define RTS_INTER_FRAME_GAP_US  (30415)
 
-#define bRts_MaxFrameSize_c	(23)	// length of frame buffer in bytes
-#define bRts_PreambleSize_c	(9)	// offset of payload in frame buffer in bytes
+#define bRts_PreambleSize_c	(9)	// length of preamble in bytes
+#define bRts_PayloadSize_c	(14)	// length of encoded payload in bytes
 
-// Array which holds the frame bits
+// Preamble sent before every frame
 // WARNING: LSB shifted out first!!!!!
-uint8_t abRts_FrameArray[bRts_MaxFrameSize_c] = {
+// Not left to rf_set_framing(): it doesn't fit the sync word, and the
+// module's Manchester encoding would also encode the inter frame gaps.
+static const uint8_t abRts_Preamble[bRts_PreambleSize_c] = {
 		0x01, 0xe1, 0xe1, 0xe1, 0xe1, 0xe1, 0xe1, 0xe1, // hardware sync
 		0xfe, // software sync
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00  // payload
 };
 
 /**
@@ -91,6 +90,7 @@ int sx1231_rts_init(rf_dev_t *sdev)
 int sx1231_rts_send(rf_dev_t *sdev, uint8_t data[7], bool long_press)
 {
 	int ret;
+	uint8_t abPayload[bRts_PayloadSize_c] = { 0 };
   	uint8_t *pbFrameHead;		// Pointer to frame Head 
 	int frame_cnt;
 	int i;
@@ -101,22 +101,22 @@ int sx1231_rts_send(rf_dev_t *sdev, uint8_t data[7], bool long_press)
 		frame_cnt = 4;
 	}
 
-	pbFrameHead = &abRts_FrameArray[bRts_PreambleSize_c];
+	pbFrameHead = abPayload;
 	for (i = 0; i < 7; i++) {
 		pbFrameHead = encode_rts(pbFrameHead, data[i]);
 	}
 
-	struct timespec ifg_time = {
-		0, RTS_INTER_FRAME_GAP_US * 1000
+	// Send all repeats, including inter frame gaps, in one transmission
+	struct iovec frame[2] = {
+		{ (void *) abRts_Preamble, sizeof(abRts_Preamble) },
+		{ abPayload, sizeof(abPayload) }
 	};
-	for (i = 0; i < frame_cnt; i++) {
-		ret =  rf_send(sdev, abRts_FrameArray, bRts_MaxFrameSize_c);
-		if (ret != ERR_OK) {
-			return ret;
-		}
-
-		// TODO: handle errors/interuptions...
-		nanosleep(&ifg_time, NULL);
+	rf_train_entry_t train = {
+		frame, 2, frame_cnt, RTS_INTER_FRAME_GAP_US
+	};
+	ret = rf_send_train(sdev, &train, 1);
+	if (ret != ERR_OK) {
+		return ret;
 	}
 
 	return ERR_OK;
@@ -384,7 +384,7 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (rf_open(&dev, dev_path) != 0) {
+	if (rf_open(&dev, dev_path, RF_SPI_SPEED_DEFAULT) != 0) {
 		goto bad1;
 	}
 
@@ -0,0 +1,220 @@
+/**
+ * sx1231_trace.c - Print binary trace ring of libsx1231_ods
+ *
+ * Copyright (c) 2019, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "config.h"
+#include "version.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "trace.h"
+
+/**
+ * Print a single trace record
+ *
+ * @param rec		Record to print
+ * @param t0		Time of first printed record
+ * @param prev		Time of previous record
+ */
+static void print_rec(const trace_rec_t *rec, uint64_t t0, uint64_t prev)
+{
+	size_t len;
+	size_t i;
+
+	printf("%10.6f +%9.3f ", (rec->time - t0) / 1e9,
+			(rec->time - prev) / 1e3);
+
+	switch (rec->type) {
+	case TRACE_SPI_READ:
+	case TRACE_SPI_WRITE:
+		printf("SPI %s 0x%02x [%3u]:",
+			(rec->type == TRACE_SPI_WRITE) ? "W" : "R",
+			rec->addr, rec->len);
+		len = (rec->len < TRACE_DATA_LEN) ? rec->len : TRACE_DATA_LEN;
+		for (i = 0; i < len; i++) {
+			printf(" %02x", rec->data[i]);
+		}
+		printf("%s (%.1f us)\n", (len < rec->len) ? " ..." : "",
+			rec->arg / 1e3);
+		break;
+	case TRACE_SPI_ERROR:
+		printf("SPI ERROR 0x%02x: 0x%08" PRIx32 "\n", rec->addr,
+			rec->arg);
+		break;
+	case TRACE_MODE:
+		printf("MODE 0x%02x -> 0x%02" PRIx32 "\n", rec->addr, rec->arg);
+		break;
+	case TRACE_REFILL:
+		printf("REFILL %u bytes, FIFO level %" PRIu32 "\n", rec->len,
+			rec->arg);
+		break;
+	case TRACE_UNDERRUN:
+		printf("UNDERRUN FIFO empty before refill of %u bytes\n",
+			rec->len);
+		break;
+	case TRACE_SEND_START:
+		printf("SEND %u bytes\n", rec->len);
+		break;
+	case TRACE_SEND_DONE:
+		printf("SEND DONE %u bytes: 0x%08" PRIx32 "\n", rec->len,
+			rec->arg);
+		break;
+	case TRACE_RECOVER:
+		printf("RECOVER after 0x%08" PRIx32 "\n", rec->arg);
+		break;
+	default:
+		printf("UNKNOWN type %u\n", rec->type);
+		break;
+	}
+}
+
+void usage(const char *name)
+{
+	fprintf(stderr,
+		"SX1231 Trace Dump - " VERSION "\n"
+		"\n"
+		"usage: %s [options] <trace file>\n"
+		"\n"
+		"Options:\n"
+		" -n <count>	Only print the last count records\n"
+		" -h		Print this help message\n"
+		"\n"
+		"Prints the records of a trace file written by sx1231_raw --trace\n"
+		"or rf_trace_open(), oldest first. Times are in seconds since the\n"
+		"first printed record, followed by microseconds since the previous\n"
+		"record.\n"
+		, name);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	char *endp;
+	unsigned long count = 0;
+	int fd;
+	struct stat st;
+	const trace_hdr_t *hdr;
+	const trace_rec_t *recs;
+	const trace_rec_t *rec;
+	uint64_t head;
+	uint64_t first;
+	uint64_t seq;
+	uint64_t t0 = 0;
+	uint64_t prev = 0;
+	unsigned long skipped = 0;
+
+	while ((opt = getopt(argc, argv, "n:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			count = strtoul(optarg, &endp, 0);
+			if (*endp != '\0' || count == 0) {
+				fprintf(stderr, "count not a valid number\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+			break;
+		default: /* '?' */
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind != 1) {
+		fprintf(stderr, "Incorrect amount of arguments\n");
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		perror("ERROR: Failed to open trace file");
+		exit(EXIT_FAILURE);
+	}
+	if ((size_t) st.st_size < sizeof(trace_hdr_t)) {
+		fprintf(stderr, "ERROR: Not a trace file\n");
+		exit(EXIT_FAILURE);
+	}
+
+	hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED) {
+		perror("ERROR: Failed to map trace file");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	if (hdr->magic != TRACE_MAGIC || hdr->version != TRACE_VERSION ||
+			hdr->rec_size != sizeof(trace_rec_t) ||
+			(size_t) st.st_size != sizeof(trace_hdr_t) +
+				(size_t) hdr->rec_cnt * sizeof(trace_rec_t)) {
+		fprintf(stderr, "ERROR: Not a trace file, or unsupported "
+				"version\n");
+		exit(EXIT_FAILURE);
+	}
+	recs = (const trace_rec_t *) (hdr + 1);
+
+	// Older records are overwritten
+	head = atomic_load(&hdr->head);
+	first = (head > hdr->rec_cnt) ? head - hdr->rec_cnt : 0;
+	if (count != 0 && head - first > count) {
+		first = head - count;
+	}
+
+	for (seq = first; seq < head; seq++) {
+		rec = &recs[seq & (hdr->rec_cnt - 1)];
+		if (atomic_load(&rec->seq) != seq + 1) {
+			// Still being written, or overwritten while printing
+			skipped++;
+			continue;
+		}
+		if (t0 == 0) {
+			t0 = prev = rec->time;
+		}
+		print_rec(rec, t0, prev);
+		prev = rec->time;
+	}
+
+	if (skipped != 0) {
+		fprintf(stderr, "%lu incomplete records skipped\n", skipped);
+	}
+
+	munmap((void *) hdr, st.st_size);
+
+	return EXIT_SUCCESS;
+}